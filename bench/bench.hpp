@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace bench {
+// Returns the time it took to call func in seconds
+template <typename Func>
+double measure(Func&& func)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    func();
+    const auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+inline void report(std::string_view name, double seconds, size_t iterations = 1)
+{
+    fmt::print("{:<40} {:>10.3f} ms {:>12.3f} us/iter\n", name, seconds * 1000.0,
+        seconds * 1e6 / static_cast<double>(iterations));
+}
+
+inline void reportThroughput(std::string_view name, double seconds, size_t bytes)
+{
+    fmt::print("{:<40} {:>10.3f} ms {:>10.2f} GB/s\n", name, seconds * 1000.0,
+        static_cast<double>(bytes) / seconds / 1e9);
+}
+
+// Something that looks a little like source code or a log file
+inline std::string generateText(size_t size, uint32_t seed = 0)
+{
+    std::mt19937 rng(seed);
+    std::string text;
+    text.reserve(size + 128);
+    while (text.size() < size) {
+        const auto lineLength = rng() % 100;
+        for (size_t i = 0; i < lineLength; ++i)
+            text.push_back(rng() % 6 == 0 ? ' ' : static_cast<char>('a' + rng() % 26));
+        text.push_back('\n');
+    }
+    text.resize(size);
+    return text;
+}
+
+// Paths like in a large project, for the prompt options
+inline std::vector<std::string> generatePaths(size_t count, uint32_t seed = 0)
+{
+    static constexpr std::string_view words[] = { "src", "lib", "test", "core", "util", "net",
+        "render", "buffer", "editor", "event", "handler", "config", "file", "index", "parser",
+        "fuzzy", "search", "main", "thread", "pool", "io", "http", "json", "data", "common" };
+    static constexpr std::string_view extensions[] = { ".cpp", ".hpp", ".c", ".h", ".py", ".md" };
+    const auto word = [&](std::mt19937& rng) { return words[rng() % std::size(words)]; };
+
+    std::mt19937 rng(seed);
+    std::vector<std::string> paths;
+    paths.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        std::string path;
+        const auto depth = 1 + rng() % 5;
+        for (size_t d = 0; d < depth; ++d) {
+            path.append(word(rng));
+            if (rng() % 3 == 0)
+                path.append(rng() % 2 ? "_" : "-").append(word(rng));
+            path.push_back('/');
+        }
+        path.append(word(rng));
+        if (rng() % 2) {
+            // camelCase
+            auto next = std::string(word(rng));
+            next[0] = static_cast<char>(next[0] - 'a' + 'A');
+            path.append(next);
+        }
+        path.append(std::to_string(rng() % 100));
+        path.append(extensions[rng() % std::size(extensions)]);
+        paths.push_back(std::move(path));
+    }
+    return paths;
+}
+}
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <limits>
+
+#include "bench.hpp"
+#include "fuzzy.hpp"
+
+namespace {
+// What the prompt did before
+size_t fuzzyMatchScoreOld(std::string_view input, std::string_view str)
+{
+    size_t s = 0;
+    size_t score = std::numeric_limits<size_t>::max();
+    for (size_t i = 0; i < input.size(); ++i) {
+        while (s < str.size() && std::tolower(str[s]) != std::tolower(input[i]))
+            s++;
+        if (s == str.size())
+            return 0;
+        score -= s;
+        score -= s - 1;
+    }
+    return score;
+}
+
+struct Option {
+    size_t index;
+    size_t score;
+};
+
+struct Match {
+    fuzzy::Score score;
+    size_t index;
+};
+
+// Like Prompt::rankOptions
+std::vector<Match> filter(const fuzzy::Matcher& matcher, const std::vector<Match>& candidates,
+    const std::vector<std::string>& paths, const std::vector<uint64_t>& charMasks, size_t k)
+{
+    std::vector<Match> matches;
+    for (const auto& candidate : candidates) {
+        const auto i = candidate.index;
+        if (!matcher.mayMatch(charMasks[i]))
+            continue;
+        const auto score = matcher.score(paths[i]);
+        if (score != fuzzy::NoMatch)
+            matches.push_back(Match { score, i });
+    }
+    k = std::min(k, matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + k, matches.end(),
+        [](const Match& a, const Match& b) { return a.score > b.score; });
+    return matches;
+}
+}
+
+int main(int argc, char** argv)
+{
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 1000 * 1000;
+    const auto paths = bench::generatePaths(count);
+    static constexpr size_t numRuns = 5;
+    static constexpr size_t numDisplayed = 7;
+
+    std::vector<uint64_t> charMasks;
+    const auto maskTime = bench::measure([&] {
+        for (const auto& path : paths)
+            charMasks.push_back(fuzzy::getCharMask(path));
+    });
+    fmt::print("{} paths, e.g. {}\n", count, paths[0]);
+    bench::report("char masks", maskTime);
+
+    std::vector<Match> all;
+    for (size_t i = 0; i < paths.size(); ++i)
+        all.push_back(Match { 0, i });
+
+    // From many to no matches
+    for (const std::string_view query :
+        { "e", "ed", "edc", "srcedit", "bufferhandlercpp", "qzx" }) {
+        fmt::print("query: '{}'\n", query);
+
+        std::vector<Option> options;
+        const auto oldTime = bench::measure([&] {
+            for (size_t r = 0; r < numRuns; ++r) {
+                options.clear();
+                for (size_t i = 0; i < paths.size(); ++i)
+                    options.push_back(Option { i, fuzzyMatchScoreOld(query, paths[i]) });
+                std::stable_sort(options.begin(), options.end(),
+                    [](const Option& a, const Option& b) { return a.score < b.score; });
+            }
+        });
+        const auto oldMatching = std::count_if(
+            options.begin(), options.end(), [](const Option& o) { return o.score > 0; });
+        bench::report(fmt::format("old: score all, sort ({} matches)", oldMatching), oldTime,
+            numRuns);
+
+        std::vector<Match> matches;
+        const fuzzy::Matcher matcher(query);
+        const auto newTime = bench::measure([&] {
+            for (size_t r = 0; r < numRuns; ++r)
+                matches = filter(matcher, all, paths, charMasks, numDisplayed);
+        });
+        bench::report(fmt::format("new: prefilter, DP, top {} ({} matches)", numDisplayed,
+                          matches.size()),
+            newTime, numRuns);
+        if (!matches.empty())
+            fmt::print("best: {}\n", paths[matches[0].index]);
+    }
+
+    // Typing one character at a time. The prompt only scores the matches of the shorter query.
+    const std::string_view typed = "bufferhandlercpp";
+    fmt::print("typing '{}'\n", typed);
+    for (const auto incremental : { false, true }) {
+        const auto time = bench::measure([&] {
+            auto matches = all;
+            for (size_t len = 1; len <= typed.size(); ++len) {
+                const fuzzy::Matcher matcher(typed.substr(0, len));
+                matches = filter(matcher, incremental ? matches : all, paths, charMasks,
+                    numDisplayed);
+            }
+        });
+        bench::report(incremental ? "narrowing" : "from scratch", time, typed.size());
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include "bench.hpp"
+#include "newline.hpp"
+
+int main(int argc, char** argv)
+{
+    const size_t sizeMb = argc > 1 ? std::stoul(argv[1]) : 256;
+    const auto text = bench::generateText(sizeMb * 1024 * 1024);
+    static constexpr size_t numRuns = 5;
+
+    fmt::print("{} MB, selected kernel: {}\n", sizeMb, newline::getKernel().name);
+    for (const auto& kernel : newline::getKernels()) {
+        size_t count = 0;
+        const auto countTime = bench::measure([&] {
+            for (size_t i = 0; i < numRuns; ++i)
+                count = kernel.count(text.data(), text.size());
+        });
+        bench::reportThroughput(fmt::format("{} count ({} newlines)", kernel.name, count),
+            countTime, text.size() * numRuns);
+
+        // Finding the last newline has to look at all of them, just like updating a line index
+        size_t last = 0;
+        const auto findTime = bench::measure([&] {
+            for (size_t i = 0; i < numRuns; ++i)
+                last = kernel.find(text.data(), text.size(), count - 1);
+        });
+        bench::reportThroughput(fmt::format("{} find (last at {})", kernel.name, last), findTime,
+            text.size() * numRuns);
+    }
+    return 0;
+}
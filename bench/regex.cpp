@@ -0,0 +1,25 @@
+#include "bench.hpp"
+#include "regex.hpp"
+
+int main(int argc, char** argv)
+{
+    const size_t sizeMb = argc > 1 ? std::stoul(argv[1]) : 64;
+    const auto str = bench::generateText(sizeMb * 1024 * 1024);
+    const TextBuffer text(str);
+
+    fmt::print("{} MB\n", sizeMb);
+    // With a literal prefix, without one and ones that can match empty (like "\s*foo" while it's
+    // typed), which find has to skip
+    for (const std::string_view pattern : { "foo", "the [a-z]+", "[a-z]+ing\\b", "\\bq\\w*",
+             "x?", "[xyz]*", "\\s*", "\\s*foo", "(?:the)??" }) {
+        const auto regex = regex::Regex::compile(pattern);
+        if (!regex) {
+            fmt::print("'{}': {}\n", pattern, regex.error());
+            continue;
+        }
+        size_t count = 0;
+        const auto time = bench::measure([&] { count = regex.value().findAll(text).size(); });
+        bench::reportThroughput(fmt::format("'{}' ({} matches)", pattern, count), time, str.size());
+    }
+    return 0;
+}
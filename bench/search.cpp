@@ -0,0 +1,68 @@
+#include "bench.hpp"
+#include "search.hpp"
+
+namespace {
+// What find did before
+size_t findNaive(const TextBuffer& text, std::string_view needle)
+{
+    size_t count = 0;
+    for (size_t i = 0; i + needle.size() <= text.getSize(); ++i) {
+        bool match = true;
+        for (size_t j = 0; j < needle.size() && match; ++j)
+            match = text[i + j] == needle[j];
+        if (match) {
+            count++;
+            i += needle.size() - 1;
+        }
+    }
+    return count;
+}
+}
+
+int main(int argc, char** argv)
+{
+    const size_t sizeMb = argc > 1 ? std::stoul(argv[1]) : 256;
+    const auto str = bench::generateText(sizeMb * 1024 * 1024);
+    const TextBuffer text(str);
+    static constexpr size_t numRuns = 5;
+
+    fmt::print("{} MB, selected kernel: {}\n", sizeMb, search::getKernel().name);
+    // Short and long, rare and common (the generated text only has lowercase letters)
+    for (const std::string_view needle : { "e", "the", " foo", "qqq", "abcdefghijklmnopqrstuvwxyz",
+             " a b c d e f", "NOT IN THERE" }) {
+        fmt::print("needle: '{}'\n", needle);
+        const search::Pattern pattern(needle);
+        const auto shift = search::makeShiftTable(needle);
+        for (const auto& kernel : search::getKernels()) {
+            size_t count = 0;
+            const auto time = bench::measure([&] {
+                for (size_t i = 0; i < numRuns; ++i) {
+                    count = 0;
+                    std::string_view rest = str;
+                    while (true) {
+                        const auto idx = kernel.find(rest, needle, shift);
+                        if (idx >= rest.size())
+                            break;
+                        count++;
+                        rest.remove_prefix(idx + needle.size());
+                    }
+                }
+            });
+            bench::reportThroughput(
+                fmt::format("{} contiguous ({} matches)", kernel.name, count), time,
+                str.size() * numRuns);
+        }
+
+        size_t count = 0;
+        const auto textTime = bench::measure([&] {
+            for (size_t i = 0; i < numRuns; ++i)
+                count = pattern.findAll(text).size();
+        });
+        bench::reportThroughput(
+            fmt::format("TextBuffer findAll ({} matches)", count), textTime, str.size() * numRuns);
+
+        const auto naiveTime = bench::measure([&] { count = findNaive(text, needle); });
+        bench::reportThroughput(fmt::format("naive ({} matches)", count), naiveTime, str.size());
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench.hpp"
+#include "rope.hpp"
+
+// This is how TextBuffer stored it's text before it used a Rope
+class FlatText {
+public:
+    FlatText(std::string_view str)
+        : data_(str.begin(), str.end())
+    {
+    }
+
+    size_t getSize() const
+    {
+        return data_.size();
+    }
+
+    char operator[](size_t offset) const
+    {
+        return data_[offset];
+    }
+
+    void insert(size_t offset, std::string_view str)
+    {
+        data_.insert(data_.begin() + offset, str.begin(), str.end());
+    }
+
+    void remove(const Range& range)
+    {
+        const auto first = data_.begin() + range.offset;
+        data_.erase(first, first + range.length);
+    }
+
+private:
+    std::vector<char> data_;
+};
+
+template <typename Text>
+void run(std::string_view name, const std::string& str)
+{
+    fmt::print("{} ({} MB)\n", name, str.size() / 1024 / 1024);
+
+    std::unique_ptr<Text> text;
+    bench::report("construct", bench::measure([&] { text = std::make_unique<Text>(str); }));
+
+    // Typing near the top of the file
+    static constexpr size_t numEdits = 200;
+    std::mt19937 rng(0);
+    bench::report("insert (near top)", bench::measure([&] {
+        for (size_t i = 0; i < numEdits; ++i)
+            text->insert(1000 + rng() % 1000, "x");
+    }),
+        numEdits);
+
+    bench::report("remove (near top)", bench::measure([&] {
+        for (size_t i = 0; i < numEdits; ++i)
+            text->remove(Range { 1000 + rng() % 1000, 1 });
+    }),
+        numEdits);
+
+    bench::report("insert (random)", bench::measure([&] {
+        for (size_t i = 0; i < numEdits; ++i)
+            text->insert(rng() % text->getSize(), "hello\nworld");
+    }),
+        numEdits);
+
+    // This is the access pattern of drawing
+    size_t sum = 0;
+    bench::report("sequential read (1 MB)", bench::measure([&] {
+        const auto start = text->getSize() / 2;
+        for (size_t i = start; i < start + 1024 * 1024; ++i)
+            sum += static_cast<unsigned char>((*text)[i]);
+    }));
+
+    // This is the access pattern of following the cursor around
+    bench::report("random read", bench::measure([&] {
+        for (size_t i = 0; i < numEdits; ++i)
+            sum += static_cast<unsigned char>((*text)[rng() % text->getSize()]);
+    }),
+        numEdits);
+
+    fmt::print("(checksum: {})\n\n", sum);
+}
+
+int main(int argc, char** argv)
+{
+    const size_t sizeMb = argc > 1 ? std::stoul(argv[1]) : 200;
+    const auto str = bench::generateText(sizeMb * 1024 * 1024);
+    run<FlatText>("std::vector<char>", str);
+    run<Rope>("Rope", str);
+    return 0;
+}
@@ -59,7 +59,8 @@ public:
     void clear()
     {
         actions_.clear();
-        versionIdCounter_ = 0;
+        undoneCount_ = 0;
+        baseVersionId_ = ++versionIdCounter_;
     }
 
     const Action& getTop() const
@@ -72,9 +73,11 @@ public:
         return actions_[getSize() - 1].action;
     }
 
+    // Version ids are unique across all stacks (of the same Action type), so you can use it to
+    // check whether anything changed, even if the stack was cleared or belongs to something else.
     size_t getCurrentVersionId() const
     {
-        return getSize() > 0 ? actions_[getSize() - 1].versionId : 0;
+        return getSize() > 0 ? actions_[getSize() - 1].versionId : baseVersionId_;
     }
 
     size_t getSize() const
@@ -89,8 +92,9 @@ private:
         bool groupedWithPrev;
     };
 
-    // Version 0 is assigned to the state before any actions were performed
-    size_t versionIdCounter_ = 0;
+    static inline size_t versionIdCounter_ = 0;
+    // The version of the state before any actions were performed
+    size_t baseVersionId_ = ++versionIdCounter_;
     size_t undoneCount_ = 0;
     std::deque<Element> actions_;
 };
@@ -84,6 +84,13 @@ Buffer::Buffer()
     // Consider an uninitialized buffer not modified
     , savedVersionId_(actions_.getCurrentVersionId())
 {
+    static size_t nextId = 0;
+    id_ = nextId++;
+}
+
+size_t Buffer::getId() const
+{
+    return id_;
 }
 
 const TextBuffer& Buffer::getText() const
@@ -91,6 +98,11 @@ const TextBuffer& Buffer::getText() const
     return text_;
 }
 
+size_t Buffer::getVersionId() const
+{
+    return actions_.getCurrentVersionId();
+}
+
 const Cursor& Buffer::getCursor() const
 {
     return cursor_;
@@ -119,6 +131,9 @@ void Buffer::setPath(const fs::path& p)
 void Buffer::setText(std::string_view str)
 {
     text_.set(str);
+    // We can't reuse the old tree, if we don't know what changed
+    if (highlighting_)
+        highlighting_->reset();
     actions_.clear();
     cursor_ = Cursor {};
     scroll_ = 0;
@@ -126,6 +141,17 @@ void Buffer::setText(std::string_view str)
     savedVersionId_ = std::numeric_limits<size_t>::max();
 }
 
+void Buffer::appendText(std::string_view str)
+{
+    const auto modified = isModified();
+    replaceText(text_.getSize(), 0, str);
+    // The actions on the stack would not fit the text anymore
+    actions_.clear();
+    // Output is not an unsaved change
+    if (!modified)
+        savedVersionId_ = actions_.getCurrentVersionId();
+}
+
 bool Buffer::readFromFile(const fs::path& p)
 {
     const auto data = readFile(p.c_str());
@@ -265,7 +291,8 @@ void Buffer::setLanguage(const Language* lang)
 {
     language_ = lang ? lang : &languages::plainText;
     if (language_->highlighter)
-        highlighting_ = std::make_unique<Highlighting>(*language_->highlighter);
+        highlighting_ = std::make_unique<Highlighting>(
+            *language_->highlighter, [] { editor::triggerRedraw(); });
     else
         highlighting_ = nullptr;
 }
@@ -289,7 +316,7 @@ bool Buffer::getReadOnly() const
 void Buffer::updateHighlighting()
 {
     if (highlighting_)
-        highlighting_->update(text_);
+        highlighting_->update(text_, actions_.getCurrentVersionId());
 }
 
 const Highlighting* Buffer::getHighlighting() const
@@ -297,17 +324,68 @@ const Highlighting* Buffer::getHighlighting() const
     return highlighting_.get();
 }
 
+void Buffer::replaceText(size_t offset, size_t length, std::string_view str)
+{
+    if (highlighting_)
+        highlighting_->edit(text_, offset, length, str);
+    text_.remove(Range { offset, length });
+    text_.insert(offset, str);
+}
+
+// The text between the first and the last range is rebuilt in one go and replaced with a single
+// edit, so this is linear in the size of that part, no matter how many ranges there are.
+void Buffer::applyReplacements(const Replacements& replacements, bool undo)
+{
+    const auto& ranges = replacements.ranges;
+    assert(!ranges.empty());
+    // Where the ranges are in the text after the replacement
+    const auto rangeAfter = [&](size_t index, size_t removed, size_t added) {
+        return Range { ranges[index].offset - removed + added, replacements.str.size() };
+    };
+    const auto last = ranges.size() - 1;
+    const auto totalRemoved = replacements.replaced.size() - ranges[last].length;
+    const auto totalAdded = last * replacements.str.size();
+    const auto regionStart = ranges[0].offset;
+    const auto regionEnd
+        = undo ? rangeAfter(last, totalRemoved, totalAdded).end() : ranges[last].end();
+
+    std::string region;
+    const auto append = [&region](std::string_view chunk) {
+        region.append(chunk);
+        return true;
+    };
+    size_t pos = regionStart;
+    size_t removed = 0;
+    size_t added = 0;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        const auto range = undo ? rangeAfter(i, removed, added) : ranges[i];
+        text_.forEachChunk(pos, range.offset, append);
+        if (undo)
+            region.append(replacements.replaced, removed, ranges[i].length);
+        else
+            region.append(replacements.str);
+        pos = range.end();
+        removed += ranges[i].length;
+        added += replacements.str.size();
+    }
+    replaceText(regionStart, regionEnd - regionStart, region);
+}
+
 void Buffer::TextAction::perform() const
 {
-    buffer->text_.remove(Range { offset, textBefore.size() });
-    buffer->text_.insert(offset, textAfter);
+    if (replacements)
+        buffer->applyReplacements(*replacements, false);
+    else
+        buffer->replaceText(offset, textBefore.size(), textAfter);
     buffer->cursor_ = cursorAfter;
 }
 
 void Buffer::TextAction::undo() const
 {
-    buffer->text_.remove(Range { offset, textAfter.size() });
-    buffer->text_.insert(offset, textBefore);
+    if (replacements)
+        buffer->applyReplacements(*replacements, true);
+    else
+        buffer->replaceText(offset, textAfter.size(), textBefore);
     buffer->cursor_ = cursorBefore;
 }
 
@@ -317,6 +395,8 @@ bool Buffer::shouldMerge(const TextAction& action) const
         return false;
 
     const auto& top = actions_.getTop();
+    if (top.replacements)
+        return false;
 
     const bool isInsertion = action.textAfter.size() > 0;
     if (isInsertion) {
@@ -350,7 +430,7 @@ void Buffer::insert(std::string_view str)
         deleteSelection();
 
     auto cursorAfter = cursor_;
-    const auto newLines = std::count(str.cbegin(), str.cend(), '\n');
+    const auto newLines = countNewlines(str);
     cursorAfter.setY(cursorAfter.start.y + newLines, false);
     if (newLines > 0) {
         const auto nl = str.rfind('\n');
@@ -477,6 +557,40 @@ void Buffer::deleteSelectedLines()
     actions_.getTop().cursorBefore = cursorBefore;
 }
 
+void Buffer::replaceAll(const std::vector<Range>& ranges, std::string_view str)
+{
+    if (readOnly_ || ranges.empty())
+        return;
+
+    Replacements replacements { ranges, "", std::string(str) };
+    size_t replacedSize = 0;
+    for (const auto& range : ranges)
+        replacedSize += range.length;
+    replacements.replaced.reserve(replacedSize);
+    for (const auto& range : ranges) {
+        text_.forEachChunk(range.offset, range.end(), [&replacements](std::string_view chunk) {
+            replacements.replaced.append(chunk);
+            return true;
+        });
+    }
+
+    // Keep the cursor where it was relative to the text around it
+    const auto cursorOffset = getCursorOffset(cursor_.min());
+    auto cursorOffsetAfter = cursorOffset;
+    for (const auto& range : ranges) {
+        if (range.offset >= cursorOffset)
+            break;
+        // If it's inside a range, it moves to the start of it
+        cursorOffsetAfter -= std::min(range.end(), cursorOffset) - range.offset;
+        if (range.end() <= cursorOffset)
+            cursorOffsetAfter += str.size();
+    }
+
+    actions_.perform(TextAction { this, 0, "", "", cursor_, cursor_, std::move(replacements) });
+    select(Range { cursorOffsetAfter, 0 });
+    actions_.getTop().cursorAfter = cursor_;
+}
+
 void Buffer::indent()
 {
     if (readOnly_)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <filesystem>
+#include <optional>
 
 #include "actionstack.hpp"
 #include "config.hpp"
@@ -51,9 +52,14 @@ public:
 
     Buffer();
 
+    // Unlike the address, this is never reused for a different buffer
+    size_t getId() const;
     void setPath(const fs::path& path);
     void setText(std::string_view str);
     void setTextUndoable(std::string str);
+    // For output that streams in. This ignores the read-only flag and clears the undo stack. If the
+    // buffer was not modified before, it isn't afterwards either.
+    void appendText(std::string_view str);
     bool readFromFile(const fs::path& path);
     void readFromStdin();
     void watchFileModifications();
@@ -72,6 +78,8 @@ public:
     const Highlighting* getHighlighting() const;
 
     const TextBuffer& getText() const;
+    // This changes whenever the text changes and is never reused for a different text
+    size_t getVersionId() const;
     void insert(std::string_view str);
     void deleteSelection();
     void deleteBackwards();
@@ -81,6 +89,9 @@ public:
     void dedent();
     void duplicateSelection();
     void deleteSelectedLines();
+    // Replaces all the ranges (sorted and not overlapping) with str. The text is rebuilt in a
+    // single pass and it's a single undo step, so it's fast even for many thousands of ranges.
+    void replaceAll(const std::vector<Range>& ranges, std::string_view str);
 
     const Cursor& getCursor() const;
     Cursor& getCursor();
@@ -111,6 +122,13 @@ public:
     bool redo();
 
 private:
+    // Instead of two copies of the whole text, we only save what was replaced
+    struct Replacements {
+        std::vector<Range> ranges; // in the text before
+        std::string replaced; // the text of all ranges, one after the other
+        std::string str; // what every range was replaced with
+    };
+
     struct TextAction {
         Buffer* buffer;
         size_t offset;
@@ -118,16 +136,24 @@ private:
         std::string textAfter;
         Cursor cursorBefore;
         Cursor cursorAfter;
+        // If this is set, offset, textBefore and textAfter are not used
+        std::optional<Replacements> replacements = std::nullopt;
 
         void perform() const;
         void undo() const;
     };
 
+    // All modifications of text_ (except setText) should go through this, so highlighting is
+    // kept up to date
+    void replaceText(size_t offset, size_t length, std::string_view str);
+    void applyReplacements(const Replacements& replacements, bool undo);
+
     bool shouldMerge(const TextAction& action) const;
     void performAction(std::string_view text, const Cursor& cursorAfter);
 
     std::string getLineDedent(std::string_view line) const;
 
+    size_t id_;
     TextBuffer text_;
     ActionStack<TextAction> actions_;
     size_t savedVersionId_ = std::numeric_limits<size_t>::max();
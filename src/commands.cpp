@@ -6,6 +6,7 @@
 #include "clipboard.hpp"
 #include "debug.hpp"
 #include "editor.hpp"
+#include "fileindex.hpp"
 #include "palette.hpp"
 #include "shortcuts.hpp"
 #include "util.hpp"
@@ -22,10 +23,19 @@ bool isYes(std::string_view input)
 
 namespace commands {
 namespace {
+    [[noreturn]] void exitEditor()
+    {
+        // The prompt is destroyed after the event handler, but it might own jobs (e.g. of a
+        // search), which need it to be removed.
+        if (editor::getPrompt())
+            editor::abortPrompt();
+        exit(0);
+    }
+
     editor::StatusMessage quitPromptCallback(std::string_view input)
     {
         if (isYes(input)) { // works with "yeet" in particular
-            exit(0);
+            exitEditor();
         }
         return editor::StatusMessage { "" };
     }
@@ -42,7 +52,7 @@ Command quit()
                 return;
             }
         }
-        exit(0);
+        exitEditor();
     };
 }
 
@@ -172,12 +182,20 @@ Command redo()
 Command gotoFile()
 {
     return []() {
-        const auto items = walkDirectory(".");
-        if (!items) {
-            editor::setStatusMessage("Error walking directory", editor::StatusMessage::Type::Error);
-            return;
-        }
-        editor::setPrompt(editor::Prompt { "> ", openPromptCallback, *items });
+        auto& index = getFileIndex();
+        index.start();
+        // The prompt owns the listener, so it's only called while the prompt is open
+        const auto listener = index.addListener([](const std::vector<std::string>& files) {
+            if (auto prompt = editor::getPrompt())
+                prompt->addOptions(files);
+            editor::triggerRedraw();
+        });
+        const auto confirm
+            = [listener](std::string_view input) { return openPromptCallback(input); };
+        auto prompt = editor::Prompt { "> ", confirm, index.getFiles() };
+        if (!index.isComplete() && index.getFileCount() == 0)
+            prompt.setUpdateMessage("Listing files...");
+        editor::setPrompt(std::move(prompt));
     };
 }
 
@@ -412,6 +430,16 @@ Command setTabWidth()
     return []() { editor::setPrompt(editor::Prompt { "Tab Width> ", setTabWidthCallback }); };
 }
 
+Command showFrameStats()
+{
+    return []() {
+        const auto& stats = editor::getFrameStats();
+        const auto avg = stats.frames > 0 ? stats.totalFrameTime.count() / stats.frames : 0;
+        editor::setStatusMessage(fmt::format("Frames: {}, last: {} us, average: {} us, max: {} us",
+            stats.frames, stats.lastFrameTime.count(), avg, stats.maxFrameTime.count()));
+    };
+}
+
 Command moveCursorY(int offset, bool select)
 {
     return [=]() { editor::getBuffer().moveCursorY(offset, select); };
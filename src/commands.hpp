@@ -22,8 +22,12 @@ Command cut();
 Command copy();
 Command paste();
 Command find();
+Command findRegex();
+Command findInFiles();
 Command findPrevSelection();
 Command findNextSelection();
+Command replaceAll();
+Command replaceAllRegex();
 Command setLanguage();
 Command newBuffer();
 Command renameBuffer();
@@ -34,6 +38,7 @@ Command showShortcutHelp();
 Command indentUsingSpaces();
 Command indentUsingTabs();
 Command setTabWidth();
+Command showFrameStats();
 Command moveCursorY(int offset, bool select);
 Command insertNewLine(bool insertAtEol);
 Command promptSelectUp();
@@ -1,22 +1,23 @@
 #include "commands.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <optional>
 #include <sstream>
 #include <string_view>
 
 #include "debug.hpp"
+#include "dirwalk.hpp"
 #include "editor.hpp"
+#include "eventhandler.hpp"
+#include "fileindex.hpp"
+#include "filesearch.hpp"
+#include "regex.hpp"
+#include "search.hpp"
 
 namespace {
-// This function does not check the bounds of text
-bool match(const TextBuffer& text, size_t offset, std::string_view input)
-{
-    for (size_t i = 0; i < input.size(); ++i) {
-        if (text[offset + i] != input[i])
-            return false;
-    }
-    return true;
-}
-
 struct FindResult {
     Range find;
     size_t matchIndex = 0;
@@ -25,48 +26,82 @@ struct FindResult {
 
 enum class FindMode { Normal, Next, Prev };
 
-FindResult editorFind(std::string_view input, FindMode mode = FindMode::Normal)
+// Typing in the find prompt mostly appends to the query. Every occurence of the new query is also
+// an occurence of the old one, so we only need to check the ones we found last time.
+struct FindCache {
+    size_t versionId = 0; // Buffer::getVersionId
+    std::string query;
+    // These may overlap, because a longer query might only match the second of two overlapping
+    // occurences (e.g. "aab" in "aaab").
+    std::vector<size_t> occurences;
+};
+
+FindCache& getFindCache()
 {
-    if (input.empty())
-        return FindResult {};
+    static FindCache cache;
+    return cache;
+}
 
-    const auto& text = editor::getBuffer().getText();
-    const auto cursorPos
-        = editor::getBuffer().getCursorOffset(editor::getBuffer().getCursor().start);
-    // This function was so complicated before, so I just do it this dumb, probably slow way
-    std::vector<size_t> matches;
-    matches.reserve(64);
-    size_t cursorMatch = MaxSizeT; // the index of the first match right after the cursor
-    for (size_t i = 0; i < text.getSize() - input.size(); ++i) {
-        if (match(text, i, input)) {
-            matches.push_back(i);
-            if (i >= cursorPos && cursorMatch == MaxSizeT)
-                cursorMatch = matches.size() - 1;
-            i += input.size();
+bool canNarrow(const FindCache& cache, size_t versionId, std::string_view query)
+{
+    return cache.versionId == versionId && !cache.query.empty()
+        && query.size() >= cache.query.size() && query.substr(0, cache.query.size()) == cache.query;
+}
+
+const std::vector<size_t>& findOccurences(const Buffer& buffer, std::string_view query)
+{
+    auto& cache = getFindCache();
+    const auto& text = buffer.getText();
+    const auto versionId = buffer.getVersionId();
+    if (canNarrow(cache, versionId, query)) {
+        const auto prefixSize = cache.query.size();
+        const auto suffix = query.substr(prefixSize);
+        if (!suffix.empty()) {
+            const auto mismatch = [&](size_t offset) {
+                return !search::matchesAt(text, offset + prefixSize, suffix);
+            };
+            auto& occ = cache.occurences;
+            occ.erase(std::remove_if(occ.begin(), occ.end(), mismatch), occ.end());
         }
+    } else {
+        cache.occurences = search::Pattern(query).findAll(text, 0, std::string_view::npos, true);
     }
+    cache.versionId = versionId;
+    cache.query = query;
+    return cache.occurences;
+}
 
+// matches have to be sorted and must not overlap
+FindResult selectMatch(const std::vector<Range>& matches, FindMode mode)
+{
     if (matches.empty())
         return FindResult {};
 
+    const auto cursorPos
+        = editor::getBuffer().getCursorOffset(editor::getBuffer().getCursor().start);
+
     FindResult res;
     res.occurences = matches.size();
 
-    if (cursorMatch == MaxSizeT) // the next after the cursor is at the start of the file
+    // the index of the first match right after the cursor
+    const auto before = [](const Range& match, size_t pos) { return match.offset < pos; };
+    size_t cursorMatch
+        = std::lower_bound(matches.begin(), matches.end(), cursorPos, before) - matches.begin();
+    if (cursorMatch == matches.size()) // the next after the cursor is at the start of the file
         cursorMatch = 0;
 
     if (mode == FindMode::Normal) {
         res.matchIndex = cursorMatch;
     } else if (mode == FindMode::Prev) {
-        res.matchIndex = (cursorMatch - 1) % matches.size();
+        res.matchIndex = (cursorMatch + matches.size() - 1) % matches.size();
     } else if (mode == FindMode::Next) {
-        if (cursorPos == matches[cursorMatch])
+        if (cursorPos == matches[cursorMatch].offset)
             res.matchIndex = (cursorMatch + 1) % matches.size();
         else // Just like Normal
             res.matchIndex = cursorMatch;
     }
 
-    res.find = Range { matches[res.matchIndex], input.size() };
+    res.find = matches[res.matchIndex];
 
     if (res.find.length > 0) {
         editor::getBuffer().select(res.find);
@@ -75,9 +110,69 @@ FindResult editorFind(std::string_view input, FindMode mode = FindMode::Normal)
     return res;
 }
 
-std::string& getLastFind()
+// Like we would find them if we searched from the start of the buffer and continued after each
+// match
+std::vector<Range> getMatches(std::string_view query)
+{
+    std::vector<Range> matches;
+    for (const auto offset : findOccurences(editor::getBuffer(), query)) {
+        if (matches.empty() || offset >= matches.back().end())
+            matches.push_back(Range { offset, query.size() });
+    }
+    return matches;
+}
+
+FindResult editorFind(std::string_view input, FindMode mode = FindMode::Normal)
+{
+    if (input.empty())
+        return FindResult {};
+    return selectMatch(getMatches(input), mode);
+}
+
+// Finding the next match of the same regex doesn't have to search the whole buffer again
+struct RegexFindCache {
+    size_t versionId = 0; // Buffer::getVersionId
+    std::string pattern;
+    std::vector<Range> matches;
+    double milliseconds = 0.0;
+};
+
+RegexFindCache& getRegexFindCache()
+{
+    static RegexFindCache cache;
+    return cache;
+}
+
+// Returns an error message if the pattern is invalid
+std::optional<std::string> updateRegexFindCache(std::string_view pattern)
 {
-    static std::string find;
+    auto& cache = getRegexFindCache();
+    const auto& buffer = editor::getBuffer();
+    if (cache.versionId == buffer.getVersionId() && cache.pattern == pattern)
+        return std::nullopt;
+
+    const auto regex = regex::Regex::compile(pattern);
+    if (!regex)
+        return regex.error();
+    const auto start = std::chrono::steady_clock::now();
+    cache.matches = regex.value().findAll(buffer.getText());
+    const auto duration = std::chrono::steady_clock::now() - start;
+    cache.milliseconds = std::chrono::duration<double, std::milli>(duration).count();
+    cache.versionId = buffer.getVersionId();
+    cache.pattern = pattern;
+    debug("Regex /{}/: {} matches in {:.1f} ms", pattern, cache.matches.size(), cache.milliseconds);
+    return std::nullopt;
+}
+
+struct LastFind {
+    std::string query;
+    std::string regex;
+    bool wasRegex = false; // whether the last find used the regex
+};
+
+LastFind& getLastFind()
+{
+    static LastFind find;
     return find;
 }
 
@@ -104,18 +199,478 @@ editor::StatusMessage confirmCallback(std::string_view input)
 {
     const auto f = getFindStatus(input, FindMode::Normal);
     // if (f.first.occurences > 0)
-    getLastFind() = input;
+    getLastFind().query = input;
+    getLastFind().wasRegex = false;
     return f.second;
 }
 
-std::string updateCallback(editor::Prompt* prompt)
+std::pair<FindResult, editor::StatusMessage> getRegexFindStatus(
+    std::string_view pattern, FindMode mode)
 {
-    const auto text = prompt->input.getText().getString();
-    if (text.empty())
+    if (pattern.empty())
+        return std::pair(FindResult {}, editor::StatusMessage {});
+    if (const auto error = updateRegexFindCache(pattern))
+        return std::pair(
+            FindResult {}, editor::StatusMessage { *error, editor::StatusMessage::Type::Error });
+
+    const auto& cache = getRegexFindCache();
+    const auto res = selectMatch(cache.matches, mode);
+    if (res.occurences == 0)
+        return std::pair(res,
+            editor::StatusMessage { fmt::format("No matches ({:.1f} ms)", cache.milliseconds),
+                editor::StatusMessage::Type::Error });
+    return std::pair(res,
+        editor::StatusMessage { fmt::format("{} ({:.1f} ms)",
+            resultString(res, fmt::format("/{}/", pattern)), cache.milliseconds) });
+}
+
+editor::StatusMessage regexConfirmCallback(std::string_view input)
+{
+    const auto f = getRegexFindStatus(input, FindMode::Normal);
+    getLastFind().regex = input;
+    getLastFind().wasRegex = true;
+    return f.second;
+}
+
+// Whether the last find was a regex and the selection is one of its matches
+bool isLastRegexMatch(const Range& selection)
+{
+    const auto& last = getLastFind();
+    if (!last.wasRegex || updateRegexFindCache(last.regex))
+        return false;
+    const auto& matches = getRegexFindCache().matches;
+    const auto it = std::lower_bound(matches.begin(), matches.end(), selection.offset,
+        [](const Range& match, size_t offset) { return match.offset < offset; });
+    return it != matches.end() && it->offset == selection.offset
+        && it->length == selection.length;
+}
+
+std::pair<FindResult, editor::StatusMessage> getSelectionFindStatus(FindMode mode)
+{
+    const auto& buffer = editor::getBuffer();
+    if (isLastRegexMatch(buffer.getSelection()))
+        return getRegexFindStatus(getLastFind().regex, mode);
+    return getFindStatus(buffer.getSelectionString(), mode);
+}
+
+editor::StatusMessage replaceMatches(const std::vector<Range>& matches, std::string_view str)
+{
+    auto& buffer = editor::getBuffer();
+    if (buffer.getReadOnly())
+        return editor::StatusMessage { "Buffer is read-only", editor::StatusMessage::Type::Error };
+    if (matches.empty())
+        return editor::StatusMessage { "No matches", editor::StatusMessage::Type::Error };
+
+    const auto start = std::chrono::steady_clock::now();
+    buffer.replaceAll(matches, str);
+    const auto duration = std::chrono::steady_clock::now() - start;
+    debug("Replaced {} matches in {:.1f} ms", matches.size(),
+        std::chrono::duration<double, std::milli>(duration).count());
+    return editor::StatusMessage { fmt::format("Replaced {} matches", matches.size()) };
+}
+
+editor::StatusMessage replaceQueryCallback(std::string_view query)
+{
+    if (query.empty())
+        return editor::StatusMessage { "Nothing to replace", editor::StatusMessage::Type::Error };
+    getLastFind().query = query;
+    getLastFind().wasRegex = false;
+    const auto replace = [query = std::string(query)](std::string_view str) {
+        return replaceMatches(getMatches(query), str);
+    };
+    editor::setPrompt(editor::Prompt { "Replace With> ", replace });
+    return editor::getStatusMessage();
+}
+
+editor::StatusMessage replaceRegexCallback(std::string_view pattern)
+{
+    if (pattern.empty())
+        return editor::StatusMessage { "Nothing to replace", editor::StatusMessage::Type::Error };
+    if (const auto error = updateRegexFindCache(pattern))
+        return editor::StatusMessage { *error, editor::StatusMessage::Type::Error };
+    getLastFind().regex = pattern;
+    getLastFind().wasRegex = true;
+    const auto replace = [pattern = std::string(pattern)](std::string_view str) {
+        // The buffer might have changed in the meantime
+        if (const auto error = updateRegexFindCache(pattern))
+            return editor::StatusMessage { *error, editor::StatusMessage::Type::Error };
+        return replaceMatches(getRegexFindCache().matches, str);
+    };
+    editor::setPrompt(editor::Prompt { "Replace With> ", replace });
+    return editor::getStatusMessage();
+}
+
+// Searching a huge buffer takes a while, so we split it into chunks and search them on the worker
+// threads, while the prompt shows how many matches we found so far. The chunks are ordered starting
+// at the cursor, so the nearest match can be selected as soon as the chunks before it are done.
+class FindScan {
+public:
+    // Smaller buffers are searched right away
+    static constexpr size_t ChunkSize = 8 * 1024 * 1024;
+
+    // Returns the message for the prompt. Cancels the last scan.
+    std::string start(std::string_view query);
+    void cancel();
+    bool isRunning() const;
+    // The prompt was confirmed, so the progress and the result go to the status line instead
+    void detach();
+
+private:
+    struct Chunk {
+        Range range;
+        bool done = false;
+        std::vector<size_t> occurences;
+        ScopedHandlerHandle job;
+    };
+
+    void chunkDone(size_t index, std::vector<size_t> occurences);
+    void finish();
+    void setMessage(editor::StatusMessage message);
+
+    std::string query_;
+    size_t bufferId_ = 0; // see Buffer::getId
+    size_t versionId_ = 0;
+    bool detached_ = false;
+    std::vector<Chunk> chunks_; // in the order we want them, i.e. starting at the cursor
+    size_t chunksDone_ = 0;
+    size_t bytesDone_ = 0;
+    size_t matchesSoFar_ = 0;
+    // All the chunks before this one are done and don't contain any matches.
+    // It's chunks_.size() once the nearest match is selected.
+    size_t nearestChunk_ = 0;
+};
+
+// Like editorFind counts them, but only inside one chunk
+size_t countMatches(const std::vector<size_t>& occurences, size_t querySize)
+{
+    size_t count = 0;
+    size_t next = 0;
+    for (const auto offset : occurences) {
+        if (count == 0 || offset >= next) {
+            count++;
+            next = offset + querySize;
+        }
+    }
+    return count;
+}
+
+std::string FindScan::start(std::string_view query)
+{
+    cancel();
+    if (query.empty())
         return "No matches";
 
-    const auto f = getFindStatus(text, FindMode::Normal);
-    return f.second.message;
+    const auto& buffer = editor::getBuffer();
+    const auto& text = buffer.getText();
+    if (text.getSize() <= ChunkSize || canNarrow(getFindCache(), buffer.getVersionId(), query))
+        return getFindStatus(query, FindMode::Normal).second.message;
+
+    query_ = query;
+    bufferId_ = buffer.getId();
+    versionId_ = buffer.getVersionId();
+
+    const auto cursorPos = buffer.getCursorOffset(buffer.getCursor().start);
+    std::vector<size_t> bounds { cursorPos, text.getSize() };
+    for (size_t offset = 0; offset < text.getSize(); offset += ChunkSize)
+        bounds.push_back(offset);
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    chunks_.resize(bounds.size() - 1);
+    for (size_t i = 0; i < chunks_.size(); ++i)
+        chunks_[i].range = Range { bounds[i], bounds[i + 1] - bounds[i] };
+    const auto first = std::find_if(chunks_.begin(), chunks_.end(),
+        [cursorPos](const Chunk& chunk) { return chunk.range.offset == cursorPos; });
+    std::rotate(chunks_.begin(), first, chunks_.end());
+
+    const auto pattern = std::make_shared<const search::Pattern>(query);
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+        const auto range = chunks_[i].range;
+        // Copying a TextBuffer is cheap and it will not change under us
+        auto occurences = std::make_shared<std::vector<size_t>>();
+        const auto work = [text, pattern, range, occurences](const std::atomic<bool>&) {
+            // Matches that start in this chunk may end in the next one
+            const auto end = range.end() + pattern->getNeedle().size() - 1;
+            *occurences = pattern->findAll(text, range.offset, end, true);
+        };
+        const auto done = [this, i, occurences] { chunkDone(i, std::move(*occurences)); };
+        auto& eh = getEventHandler();
+        chunks_[i].job.reset(&eh, eh.addJob(work, done));
+    }
+    return "Searching...";
+}
+
+void FindScan::cancel()
+{
+    chunks_.clear(); // this cancels the jobs
+    chunksDone_ = 0;
+    bytesDone_ = 0;
+    matchesSoFar_ = 0;
+    nearestChunk_ = 0;
+}
+
+bool FindScan::isRunning() const
+{
+    return !chunks_.empty();
+}
+
+void FindScan::detach()
+{
+    detached_ = true;
+}
+
+void FindScan::setMessage(editor::StatusMessage message)
+{
+    if (detached_)
+        editor::setStatusMessage(message);
+    else if (auto prompt = editor::getPrompt())
+        prompt->setUpdateMessage(std::move(message.message));
+}
+
+void FindScan::chunkDone(size_t index, std::vector<size_t> occurences)
+{
+    const auto& buffer = editor::getBuffer();
+    if (buffer.getId() != bufferId_ || buffer.getVersionId() != versionId_) {
+        // The buffer changed (e.g. it was reloaded), so the results are useless
+        cancel();
+        if (detached_)
+            editor::setStatusMessage(editor::StatusMessage { "Search cancelled" });
+        else if (auto prompt = editor::getPrompt())
+            prompt->setUpdateMessage(start(prompt->input.getText().getString()));
+        editor::triggerRedraw();
+        return;
+    }
+
+    auto& chunk = chunks_[index];
+    chunk.done = true;
+    chunk.occurences = std::move(occurences);
+    chunksDone_++;
+    bytesDone_ += chunk.range.length;
+    matchesSoFar_ += countMatches(chunk.occurences, query_.size());
+
+    while (nearestChunk_ < chunks_.size() && chunks_[nearestChunk_].done) {
+        const auto& occ = chunks_[nearestChunk_].occurences;
+        if (!occ.empty()) {
+            editor::getBuffer().select(Range { occ.front(), query_.size() });
+            nearestChunk_ = chunks_.size();
+            break;
+        }
+        nearestChunk_++;
+    }
+
+    if (chunksDone_ == chunks_.size()) {
+        finish();
+    } else {
+        const auto percent = bytesDone_ * 100 / editor::getBuffer().getText().getSize();
+        setMessage(editor::StatusMessage {
+            fmt::format("Searching... {} matches so far ({}%)", matchesSoFar_, percent) });
+    }
+    editor::triggerRedraw();
+}
+
+void FindScan::finish()
+{
+    std::sort(chunks_.begin(), chunks_.end(),
+        [](const Chunk& a, const Chunk& b) { return a.range.offset < b.range.offset; });
+    std::vector<size_t> occurences;
+    for (const auto& chunk : chunks_)
+        occurences.insert(occurences.end(), chunk.occurences.begin(), chunk.occurences.end());
+    auto& cache = getFindCache();
+    cache.versionId = versionId_;
+    cache.query = query_;
+    cache.occurences = std::move(occurences);
+
+    // This only has to look at the cached occurences now and selects the right match
+    const auto message = getFindStatus(query_, FindMode::Normal).second;
+    cancel();
+    setMessage(message);
+}
+
+// A scan that continues after its prompt was confirmed
+std::shared_ptr<FindScan>& getDetachedScan()
+{
+    static std::shared_ptr<FindScan> scan;
+    return scan;
+}
+
+// Find in Files. The directory is walked on a worker thread (unless the file index is complete)
+// and then the files are searched in batches on all of them. The results of every batch are
+// appended to a read-only buffer as soon as it is done. The search is owned by the prompt that
+// shows the progress, so closing the prompt cancels it. The jobs only hold weak references, so
+// they don't keep it alive.
+class FileSearch : public std::enable_shared_from_this<FileSearch> {
+public:
+    // Few enough jobs that the overhead per job does not matter, but enough so that a single
+    // directory full of large files does not end up on one thread
+    static constexpr size_t BatchSize = 32;
+
+    void start(std::string_view query);
+    std::string getStatus() const;
+
+private:
+    void walkDone(std::optional<std::vector<std::string>> files);
+    void batchDone(filesearch::Result result);
+    Buffer* getResultsBuffer() const;
+    void finish(editor::StatusMessage message);
+
+    std::string query_;
+    size_t resultsId_ = 0; // see Buffer::getId
+    std::chrono::steady_clock::time_point startTime_;
+    ScopedHandlerHandle walkJob_;
+    std::vector<ScopedHandlerHandle> jobs_;
+    size_t batchesDone_ = 0;
+    size_t filesTotal_ = 0;
+    filesearch::Result total_; // without output
+};
+
+void FileSearch::start(std::string_view query)
+{
+    query_ = query;
+    startTime_ = std::chrono::steady_clock::now();
+
+    // This is empty and not modified
+    auto& results = editor::openBuffer();
+    results.name = fmt::format("Find in Files: {}", query);
+    results.setReadOnly();
+    resultsId_ = results.getId();
+
+    // If the file index is ready, we don't have to walk the directory ourselves
+    auto files = std::make_shared<std::optional<std::vector<std::string>>>();
+    if (getFileIndex().isComplete())
+        *files = getFileIndex().getFiles();
+    const auto work = [files](const std::atomic<bool>& cancelled) {
+        if (*files)
+            return;
+        std::vector<std::string> list;
+        const auto append = [&list](std::vector<std::string>&& batch) {
+            list.insert(list.end(), std::make_move_iterator(batch.begin()),
+                std::make_move_iterator(batch.end()));
+        };
+        if (dirwalk::walk(".", append, cancelled))
+            *files = std::move(list);
+    };
+    const auto done = [weak = weak_from_this(), files] {
+        if (const auto self = weak.lock())
+            self->walkDone(std::move(*files));
+    };
+    auto& eh = getEventHandler();
+    walkJob_.reset(&eh, eh.addJob(work, done));
+}
+
+std::string FileSearch::getStatus() const
+{
+    if (walkJob_.isValid())
+        return "Listing files...";
+    return fmt::format("Searching... {} matches in {}/{} files", total_.matches,
+        total_.files + total_.skipped, filesTotal_);
+}
+
+void FileSearch::walkDone(std::optional<std::vector<std::string>> files)
+{
+    walkJob_.release();
+    if (!files) {
+        finish(editor::StatusMessage {
+            "Error walking directory", editor::StatusMessage::Type::Error });
+        return;
+    }
+    filesTotal_ = files->size();
+    if (files->empty()) {
+        finish(editor::StatusMessage { "No files", editor::StatusMessage::Type::Error });
+        return;
+    }
+
+    const auto pattern = std::make_shared<const search::Pattern>(query_);
+    auto& eh = getEventHandler();
+    for (size_t first = 0; first < files->size(); first += BatchSize) {
+        const auto last = std::min(first + BatchSize, files->size());
+        auto batch = std::vector<std::string>(std::make_move_iterator(files->begin() + first),
+            std::make_move_iterator(files->begin() + last));
+        auto result = std::make_shared<filesearch::Result>();
+        const auto work = [batch = std::move(batch), pattern, result](
+                              const std::atomic<bool>& cancelled) {
+            filesearch::searchFiles(batch, *pattern, cancelled, *result);
+        };
+        const auto done = [weak = weak_from_this(), result] {
+            if (const auto self = weak.lock())
+                self->batchDone(std::move(*result));
+        };
+        jobs_.emplace_back(eh, eh.addJob(work, done));
+    }
+    if (auto prompt = editor::getPrompt())
+        prompt->setUpdateMessage(getStatus());
+    editor::triggerRedraw();
+}
+
+void FileSearch::batchDone(filesearch::Result result)
+{
+    batchesDone_++;
+    total_.files += result.files;
+    total_.skipped += result.skipped;
+    total_.bytes += result.bytes;
+    total_.matches += result.matches;
+
+    if (!result.output.empty()) {
+        if (const auto buffer = getResultsBuffer()) {
+            buffer->appendText(result.output);
+        } else {
+            // Nowhere to put the results anymore
+            finish(editor::StatusMessage { "Results buffer was closed" });
+            return;
+        }
+    }
+
+    if (batchesDone_ == jobs_.size()) {
+        const auto duration = std::chrono::steady_clock::now() - startTime_;
+        const auto ms = std::chrono::duration<double, std::milli>(duration).count();
+        debug("Searched {} files ({} bytes) in {:.1f} ms", total_.files, total_.bytes, ms);
+        const auto type = total_.matches > 0 ? editor::StatusMessage::Type::Normal
+                                             : editor::StatusMessage::Type::Error;
+        finish(editor::StatusMessage {
+            fmt::format("{} matches in {} files ({} skipped, {:.0f} ms)", total_.matches,
+                total_.files, total_.skipped, ms),
+            type });
+        return;
+    }
+
+    if (auto prompt = editor::getPrompt())
+        prompt->setUpdateMessage(getStatus());
+    editor::triggerRedraw();
+}
+
+Buffer* FileSearch::getResultsBuffer() const
+{
+    for (size_t i = 0; i < editor::getBufferCount(); ++i) {
+        if (editor::getBuffer(i).getId() == resultsId_)
+            return &editor::getBuffer(i);
+    }
+    return nullptr;
+}
+
+void FileSearch::finish(editor::StatusMessage message)
+{
+    editor::setStatusMessage(message);
+    // The prompt owns this, but the job callback that called us holds a reference until we return
+    if (editor::getPrompt())
+        editor::abortPrompt();
+    editor::triggerRedraw();
+}
+
+editor::StatusMessage findInFilesCallback(std::string_view query)
+{
+    if (query.empty())
+        return editor::StatusMessage {
+            "Nothing to search for", editor::StatusMessage::Type::Error
+        };
+    getLastFind().query = query;
+    getLastFind().wasRegex = false;
+
+    auto search = std::make_shared<FileSearch>();
+    search->start(query);
+    const auto cancel = [search](std::string_view) {
+        return editor::StatusMessage { "Search cancelled" };
+    };
+    const auto update = [search](editor::Prompt*) { return search->getStatus(); };
+    editor::setPrompt(editor::Prompt { "Searching (Enter or Escape to cancel) ", cancel, update });
+    return editor::getStatusMessage();
 }
 }
 
@@ -123,23 +678,85 @@ namespace commands {
 Command find()
 {
     return []() {
-        auto prompt = editor::Prompt { "Find> ", confirmCallback, updateCallback };
-        prompt.input.setText(getLastFind());
+        // The scan is cancelled when the prompt is closed, unless it's confirmed while scanning
+        getDetachedScan().reset();
+        auto scan = std::make_shared<FindScan>();
+        const auto update = [scan](editor::Prompt* prompt) {
+            return scan->start(prompt->input.getText().getString());
+        };
+        const auto confirm = [scan](std::string_view input) {
+            if (!scan->isRunning())
+                return confirmCallback(input);
+            // Don't search all of it again on the main thread. The scan selects the nearest
+            // match as soon as it's found and reports the result in the status line.
+            getLastFind().query = input;
+            getLastFind().wasRegex = false;
+            scan->detach();
+            getDetachedScan() = scan;
+            return editor::StatusMessage { "Searching..." };
+        };
+        auto prompt = editor::Prompt { "Find> ", confirm, update };
+        prompt.input.setText(getLastFind().query);
+        prompt.input.moveCursorEol(true);
+        editor::setPrompt(std::move(prompt));
+    };
+}
+
+Command findRegex()
+{
+    return []() {
+        const auto update = [](editor::Prompt* prompt) {
+            return getRegexFindStatus(prompt->input.getText().getString(), FindMode::Normal)
+                .second.message;
+        };
+        auto prompt = editor::Prompt { "Find Regex> ", regexConfirmCallback, update };
+        prompt.input.setText(getLastFind().regex);
+        prompt.input.moveCursorEol(true);
+        editor::setPrompt(std::move(prompt));
+    };
+}
+
+Command findInFiles()
+{
+    return []() {
+        auto prompt = editor::Prompt { "Find in Files> ", findInFilesCallback };
+        prompt.input.setText(getLastFind().query);
+        prompt.input.moveCursorEol(true);
+        editor::setPrompt(std::move(prompt));
+    };
+}
+
+Command replaceAll()
+{
+    return []() {
+        auto prompt = editor::Prompt { "Replace> ", replaceQueryCallback };
+        prompt.input.setText(getLastFind().query);
+        prompt.input.moveCursorEol(true);
+        editor::setPrompt(std::move(prompt));
+    };
+}
+
+Command replaceAllRegex()
+{
+    return []() {
+        auto prompt = editor::Prompt { "Replace Regex> ", replaceRegexCallback };
+        prompt.input.setText(getLastFind().regex);
         prompt.input.moveCursorEol(true);
         editor::setPrompt(std::move(prompt));
     };
 }
 
+// If the last find was a regex and the selection is a match, these jump to the other matches of the
+// regex. Otherwise they search for the selected text.
 Command findPrevSelection()
 {
     return []() {
-        const auto str = editor::getBuffer().getSelectionString();
-        if (str.empty()) {
+        if (editor::getBuffer().getSelection().length == 0) {
             editor::setStatusMessage("No last search");
             return;
         }
 
-        const auto f = getFindStatus(str, FindMode::Prev);
+        const auto f = getSelectionFindStatus(FindMode::Prev);
         editor::setStatusMessage(f.second.message, f.second.type);
     };
 }
@@ -147,13 +764,12 @@ Command findPrevSelection()
 Command findNextSelection()
 {
     return []() {
-        const auto str = editor::getBuffer().getSelectionString();
-        if (str.empty()) {
+        if (editor::getBuffer().getSelection().length == 0) {
             editor::setStatusMessage("No selection");
             return;
         }
 
-        const auto f = getFindStatus(str, FindMode::Next);
+        const auto f = getSelectionFindStatus(FindMode::Next);
         editor::setStatusMessage(f.second.message, f.second.type);
     };
 }
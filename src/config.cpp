@@ -86,11 +86,6 @@ fs::path getConfigHomeDirectory()
     return getHomeDirectory() / ".config";
 }
 
-fs::path getConfigDirectory()
-{
-    return getConfigHomeDirectory() / "exquisite";
-}
-
 namespace api {
     void bind(std::string_view /*input*/, std::string_view /*commandName*/,
         std::optional<sol::table> /*args*/)
@@ -176,6 +171,11 @@ Config& Config::get()
     return config;
 }
 
+fs::path getConfigDirectory()
+{
+    return getConfigHomeDirectory() / "exquisite";
+}
+
 void executeHook(std::string_view hookName)
 {
     auto hooks = getLuaState()["exq"]["_hooks"][hookName].get<sol::table>();
@@ -249,6 +249,8 @@ void loadConfig()
     lconfig["showLineNumbers"] = config.showLineNumbers;
     lconfig["highlightCurrentLine"] = config.highlightCurrentLine;
     lconfig["numPromptOptions"] = config.numPromptOptions;
+    lconfig["maxFps"] = config.maxFps;
+    lconfig["persistFileIndex"] = config.persistFileIndex;
 
     lua.script(initScript);
 
@@ -276,6 +278,8 @@ void loadConfig()
     config.showLineNumbers = lconfig["showLineNumbers"];
     config.highlightCurrentLine = lconfig["highlightCurrentLine"];
     config.numPromptOptions = lconfig["numPromptOptions"];
+    config.maxFps = lconfig["maxFps"];
+    config.persistFileIndex = lconfig["persistFileIndex"];
 
     std::vector<std::pair<std::string, Color>> cs;
     exq["colorschemes"][config.colorscheme].get<sol::table>().for_each(
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <filesystem>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -27,11 +28,16 @@ struct Config {
     bool showLineNumbers = true;
     size_t highlightCurrentLine = true;
     size_t numPromptOptions = 7;
+    size_t maxFps = 60;
+    // Save the list of files for gotoFile, so it's there right away next time
+    bool persistFileIndex = true;
 
     static Config& get();
 
     void load();
 };
 
+std::filesystem::path getConfigDirectory();
+
 void executeHook(std::string_view hookName);
 void loadConfig();
@@ -15,6 +15,21 @@ std::string moveCursor(const Vec& pos)
     return fmt::format("\x1b[{};{}H", pos.y + 1, pos.x + 1);
 }
 
+std::string setScrollRegion(size_t top, size_t bottom)
+{
+    return fmt::format("\x1b[{};{}r", top + 1, bottom + 1);
+}
+
+std::string scrollUp(size_t num)
+{
+    return fmt::format("\x1b[{}S", num);
+}
+
+std::string scrollDown(size_t num)
+{
+    return fmt::format("\x1b[{}T", num);
+}
+
 std::string setCursorStyle(int style)
 {
     return fmt::format("\x1b[{} q", style);
@@ -21,6 +21,14 @@ std::string moveCursorForward(size_t num);
 // position is 0-based, even though terminal cursor position is 1-based
 std::string moveCursor(const Vec& position);
 
+// https://vt100.net/docs/vt510-rm/DECSTBM.html
+// top and bottom are 0-based and inclusive. This also moves the cursor to 0, 0.
+std::string setScrollRegion(size_t top, size_t bottom);
+inline constexpr auto resetScrollRegion = "\x1b[r"sv;
+// These scroll the lines in the scroll region and fill the new ones with the background color
+std::string scrollUp(size_t num); // SU, contents move up
+std::string scrollDown(size_t num); // SD, contents move down
+
 // https://vt100.net/docs/vt510-rm/DECSCUSR.html
 // 5 is blinking horizontal line, 6 is non-blinking horizontal line
 std::string setCursorStyle(int style);
@@ -0,0 +1,303 @@
+#include "dirwalk.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "gitignore.hpp"
+#include "util.hpp"
+
+namespace {
+// Files are passed to the callback in batches, so it does not have to lock for every single one
+constexpr size_t BatchSize = 1024;
+
+// The patterns of the ignore files in a directory and all the ones above it
+struct IgnoreNode {
+    std::shared_ptr<const IgnoreNode> parent;
+    std::string dir; // relative to the root, "" for the root
+    std::vector<gitignore::Pattern> patterns;
+};
+
+struct Dir {
+    std::string path; // relative to the root, "" for the root
+    std::shared_ptr<const IgnoreNode> ignore;
+};
+
+bool isIgnored(const IgnoreNode* node, std::string_view path, std::string_view name, bool isDir)
+{
+    for (; node; node = node->parent.get()) {
+        const auto relPath = node->dir.empty() ? path : path.substr(node->dir.size() + 1);
+        // The last pattern that matches decides and the files further down win
+        for (auto it = node->patterns.rbegin(); it != node->patterns.rend(); ++it) {
+            if (it->matches(relPath, name, isDir))
+                return !it->negated;
+        }
+    }
+    return false;
+}
+
+class Walker {
+public:
+    Walker(std::string root, const dirwalk::Callback& callback, const std::atomic<bool>& cancelled,
+        const dirwalk::Options& options);
+
+    void run();
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Dir> dirs;
+    };
+
+    void workerMain(size_t index);
+    std::optional<Dir> pop(size_t index);
+    void push(size_t index, std::vector<Dir>& dirs);
+    void processDir(size_t index, const Dir& dir, std::vector<std::string>& files);
+    void flush(const dirwalk::Callback& callback, std::vector<std::string>& paths);
+    std::shared_ptr<const IgnoreNode> loadIgnoreFiles(
+        std::shared_ptr<const IgnoreNode> parent, const std::string& dir) const;
+
+    std::string root_;
+    const dirwalk::Callback& callback_;
+    const std::atomic<bool>& cancelled_;
+    const dirwalk::Options& options_;
+    std::vector<Queue> queues_; // one per thread
+    std::atomic<size_t> pending_ { 0 }; // directories that are queued or being processed
+    std::atomic<size_t> queued_ { 0 };
+    std::mutex idleMutex_;
+    std::condition_variable idle_;
+    std::mutex callbackMutex_;
+};
+
+Walker::Walker(std::string root, const dirwalk::Callback& callback,
+    const std::atomic<bool>& cancelled, const dirwalk::Options& options)
+    : root_(std::move(root))
+    , callback_(callback)
+    , cancelled_(cancelled)
+    , options_(options)
+    , queues_(options.numThreads)
+{
+}
+
+void Walker::run()
+{
+    auto rootIgnore = std::make_shared<IgnoreNode>();
+    if (const auto exclude = readFile(root_ + "/.git/info/exclude"))
+        rootIgnore->patterns = gitignore::parse(*exclude);
+
+    // The ignore files of the directories above subdir apply too
+    std::shared_ptr<const IgnoreNode> ignore = std::move(rootIgnore);
+    const auto& subdir = options_.subdir;
+    if (!subdir.empty()) {
+        ignore = loadIgnoreFiles(std::move(ignore), "");
+        for (auto slash = subdir.find('/'); slash != std::string::npos;
+             slash = subdir.find('/', slash + 1))
+            ignore = loadIgnoreFiles(std::move(ignore), subdir.substr(0, slash));
+    }
+
+    std::vector<Dir> start { Dir { subdir, std::move(ignore) } };
+    push(0, start);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < queues_.size(); ++i)
+        threads.emplace_back([this, i] { workerMain(i); });
+    workerMain(0);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void Walker::workerMain(size_t index)
+{
+    std::vector<std::string> files;
+    while (!cancelled_.load()) {
+        if (auto dir = pop(index)) {
+            processDir(index, *dir, files);
+            if (--pending_ == 0) {
+                std::lock_guard lock(idleMutex_);
+                idle_.notify_all();
+            }
+            continue;
+        }
+
+        // Don't sit on the files, while we wait
+        flush(callback_, files);
+        std::unique_lock lock(idleMutex_);
+        // The timeout is only for cancellation, which nobody notifies us about
+        idle_.wait_for(lock, std::chrono::milliseconds(10),
+            [this] { return queued_.load() > 0 || pending_.load() == 0; });
+        if (pending_.load() == 0)
+            break;
+    }
+    flush(callback_, files);
+}
+
+// Our own queue is used like a stack, so every thread walks depth first and the directories
+// it's working on are probably still cached. Stealing takes the oldest ones, which are usually
+// the largest subtrees.
+std::optional<Dir> Walker::pop(size_t index)
+{
+    for (size_t i = 0; i < queues_.size(); ++i) {
+        auto& queue = queues_[(index + i) % queues_.size()];
+        std::lock_guard lock(queue.mutex);
+        if (queue.dirs.empty())
+            continue;
+        Dir dir;
+        if (i == 0) {
+            dir = std::move(queue.dirs.back());
+            queue.dirs.pop_back();
+        } else {
+            dir = std::move(queue.dirs.front());
+            queue.dirs.pop_front();
+        }
+        queued_--;
+        return dir;
+    }
+    return std::nullopt;
+}
+
+void Walker::push(size_t index, std::vector<Dir>& dirs)
+{
+    if (dirs.empty())
+        return;
+    pending_ += dirs.size();
+    {
+        auto& queue = queues_[index];
+        std::lock_guard lock(queue.mutex);
+        for (auto& dir : dirs)
+            queue.dirs.push_back(std::move(dir));
+    }
+    queued_ += dirs.size();
+    {
+        // So a thread can't miss the notification between checking queued_ and waiting
+        std::lock_guard lock(idleMutex_);
+    }
+    idle_.notify_all();
+}
+
+void Walker::processDir(size_t index, const Dir& dir, std::vector<std::string>& files)
+{
+    const auto fullPath = dir.path.empty() ? root_ : root_ + "/" + dir.path;
+    DIR* d = ::opendir(fullPath.c_str());
+    if (!d) // Directories we can't read are just skipped
+        return;
+
+    struct Entry {
+        std::string name;
+        bool isDir;
+    };
+    std::vector<Entry> entries;
+    bool hasIgnoreFile = false;
+    dirent* ent;
+    while ((ent = ::readdir(d))) {
+        auto type = ent->d_type;
+        if (type == DT_UNKNOWN) {
+            // Some file systems don't fill in d_type
+            struct stat st;
+            if (::fstatat(::dirfd(d), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+
+        std::string name = ent->d_name;
+        if (type == DT_DIR) {
+            // Skip ".", ".." and everything hidden (including .git)
+            if (name[0] != '.')
+                entries.push_back(Entry { std::move(name), true });
+        } else if (type == DT_REG) {
+            if (name == ".gitignore" || name == ".ignore")
+                hasIgnoreFile = true;
+            entries.push_back(Entry { std::move(name), false });
+        }
+    }
+    ::closedir(d);
+
+    const auto ignore = hasIgnoreFile ? loadIgnoreFiles(dir.ignore, dir.path) : dir.ignore;
+
+    std::vector<Dir> subdirs;
+    for (auto& entry : entries) {
+        const auto nameSize = entry.name.size();
+        auto path = dir.path.empty() ? std::move(entry.name) : dir.path + "/" + entry.name;
+        const auto name = std::string_view(path).substr(path.size() - nameSize);
+        if (isIgnored(ignore.get(), path, name, entry.isDir))
+            continue;
+        if (entry.isDir) {
+            subdirs.push_back(Dir { std::move(path), ignore });
+        } else {
+            files.push_back(std::move(path));
+            if (files.size() >= BatchSize)
+                flush(callback_, files);
+        }
+    }
+
+    if (options_.dirCallback) {
+        std::vector<std::string> paths;
+        for (const auto& subdir : subdirs)
+            paths.push_back(subdir.path);
+        flush(options_.dirCallback, paths);
+    }
+    if (options_.recursive)
+        push(index, subdirs);
+}
+
+void Walker::flush(const dirwalk::Callback& callback, std::vector<std::string>& paths)
+{
+    if (paths.empty())
+        return;
+    {
+        std::lock_guard lock(callbackMutex_);
+        callback(std::move(paths));
+    }
+    paths.clear();
+}
+
+// Returns parent, if there are no ignore files in dir
+std::shared_ptr<const IgnoreNode> Walker::loadIgnoreFiles(
+    std::shared_ptr<const IgnoreNode> parent, const std::string& dir) const
+{
+    const auto dirPath = dir.empty() ? root_ : root_ + "/" + dir;
+    auto node = std::make_shared<IgnoreNode>();
+    // .ignore is last, so it wins
+    for (const auto name : { ".gitignore", ".ignore" }) {
+        if (const auto data = readFile(dirPath + "/" + name)) {
+            auto patterns = gitignore::parse(*data);
+            node->patterns.insert(node->patterns.end(), std::make_move_iterator(patterns.begin()),
+                std::make_move_iterator(patterns.end()));
+        }
+    }
+    if (node->patterns.empty())
+        return parent;
+    node->parent = std::move(parent);
+    node->dir = dir;
+    return node;
+}
+}
+
+namespace dirwalk {
+bool walk(const fs::path& root, const Callback& callback, const std::atomic<bool>& cancelled,
+    const Options& options)
+{
+    auto rootStr = root.u8string();
+    const auto startPath = options.subdir.empty() ? rootStr : rootStr + "/" + options.subdir;
+    if (DIR* d = ::opendir(startPath.c_str()))
+        ::closedir(d);
+    else
+        return false;
+
+    auto opts = options;
+    if (opts.numThreads == 0)
+        opts.numThreads = std::max(1u, std::thread::hardware_concurrency());
+    // A single directory is not worth starting threads for
+    if (!opts.recursive)
+        opts.numThreads = 1;
+    Walker(std::move(rootStr), callback, cancelled, opts).run();
+    return true;
+}
+}
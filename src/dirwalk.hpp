@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Lists all the files in a directory tree on multiple threads. Every thread has its own queue of
+// directories and if it runs out, it steals from the others. Files and directories that are
+// ignored by .gitignore, .ignore or .git/info/exclude are skipped, as are hidden directories.
+// Ignored directories are never opened. We only stat entries if the file system does not tell us
+// their type in readdir. Symlinks are not followed.
+namespace dirwalk {
+// Called on the worker threads (but never at the same time) with the paths of the files
+// relative to the root
+using Callback = std::function<void(std::vector<std::string>&& files)>;
+
+struct Options {
+    // Only walk this directory (relative to the root), but with the ignore files above it
+    std::string subdir = "";
+    // If false, only the files directly in subdir are listed
+    bool recursive = true;
+    // Called like callback with the directories that were found (not including subdir)
+    Callback dirCallback = nullptr;
+    // 0 means one thread per core
+    size_t numThreads = 0;
+};
+
+// Blocks until everything is walked or cancelled is set. The calling thread helps too.
+// Returns false if the root (or subdir) could not be opened.
+bool walk(const fs::path& root, const Callback& callback, const std::atomic<bool>& cancelled,
+    const Options& options = {});
+}
@@ -3,14 +3,16 @@
 #include <cassert>
 #include <cmath>
 #include <string_view>
+#include <thread>
+#include <utility>
 
 #include <unistd.h>
 
 #include "config.hpp"
-#include "control.hpp"
 #include "debug.hpp"
 #include "eventhandler.hpp"
 #include "fuzzy.hpp"
+#include "screen.hpp"
 #include "terminal.hpp"
 #include "utf8.hpp"
 #include "util.hpp"
@@ -33,33 +35,12 @@ namespace {
         die(fmt::format("Unhandled control character: {}", static_cast<int>(ch)));
     }
 
-    template <typename Value = size_t>
-    class LazyMappedTerminalState {
-    public:
-        LazyMappedTerminalState(const std::vector<std::string>& values, Value initial = {})
-            : values_(values)
-            , current_(initial)
-        {
-            set(current_, true);
-        }
-
-        void set(Value v, bool override = false)
-        {
-            if (current_ != v || override)
-                terminal::bufferWrite(values_[static_cast<size_t>(v)]);
-            current_ = v;
-        }
-
-        Value get() const
-        {
-            return current_;
-        }
-
-    private:
-        std::vector<std::string> values_;
-        Value current_ = 0;
-    };
+    Screen screen;
 
+    using Clock = std::chrono::steady_clock;
+    bool redrawScheduled = false;
+    Clock::time_point lastFrameStart;
+    FrameStats frameStats;
     StatusMessage statusMessage;
     std::unique_ptr<Prompt> currentPrompt;
     bool readOnly = false;
@@ -79,7 +60,7 @@ Vec drawBuffer(Buffer& buffer, const Vec& pos, const Vec& size, bool prompt = fa
 {
     const auto& config = Config::get();
 
-    terminal::bufferWrite(control::sgr::reset);
+    screen.resetStyle();
 
     // It kinda sucks to scroll in a draw function, but only here do we know the actual view size
     // This is the only reason the buffer reference is not const!
@@ -92,9 +73,6 @@ Vec drawBuffer(Buffer& buffer, const Vec& pos, const Vec& size, bool prompt = fa
     assert(firstLine < lineCount);
     assert(lastLine < lineCount);
 
-    LazyMappedTerminalState<bool> invert(
-        { std::string(control::sgr::resetInvert), std::string(control::sgr::invert) });
-
     const auto showLineNumbers = config.showLineNumbers && !prompt;
     // Always make space for at least 3 digits
     const auto lineNumDigits = std::max(3, static_cast<int>(std::log10(lineCount) + 1));
@@ -102,7 +80,7 @@ Vec drawBuffer(Buffer& buffer, const Vec& pos, const Vec& size, bool prompt = fa
     const size_t lineNumWidth = showLineNumbers ? lineNumDigits + 2 : 0;
     const auto textWidth = subClamp(size.x, lineNumWidth);
 
-    terminal::bufferWrite(control::moveCursor(pos));
+    screen.moveCursor(pos);
     const auto cursor = buffer.getCursor().start;
     auto drawCursor = Vec { lineNumWidth + pos.x, pos.y + cursor.y - buffer.getScroll() };
 
@@ -120,27 +98,17 @@ Vec drawBuffer(Buffer& buffer, const Vec& pos, const Vec& size, bool prompt = fa
     const auto highlightCurrentLine = config.highlightCurrentLine && !prompt;
 
     enum class Background { Normal = 0, CurrentLine, Highlight };
-    LazyMappedTerminalState<Background> background({
-        std::string(control::sgr::bgColorPrefix) + colorScheme["background"],
-        std::string(control::sgr::bgColorPrefix) + colorScheme["highlight.currentline"],
-        std::string(control::sgr::bgColorPrefix) + colorScheme["highlight.selection"],
-    });
-
-    std::string currentFgColor = "";
-    auto setFgColor = [&currentFgColor](std::string_view color) {
-        if (color != currentFgColor) {
-            if (color == control::sgr::resetFgColor) {
-                terminal::bufferWrite(control::sgr::resetFgColor);
-            } else {
-                terminal::bufferWrite(control::sgr::fgColorPrefix);
-                terminal::bufferWrite(color);
-            }
-            currentFgColor = color;
-        }
+    const std::array<std::string_view, 3> backgrounds {
+        colorScheme["background"],
+        colorScheme["highlight.currentline"],
+        colorScheme["highlight.selection"],
+    };
+    auto setBackground = [&backgrounds](Background bg) {
+        screen.setBgColor(backgrounds[static_cast<size_t>(bg)]);
     };
+    auto setInvert = [](bool invert) { screen.setAttribute(Screen::Attribute::Invert, invert); };
 
-    const auto whitespaceColor
-        = std::string(control::sgr::fgColorPrefix) + colorScheme["whitespace"];
+    const auto& whitespaceColor = colorScheme["whitespace"];
 
     buffer.updateHighlighting();
     const auto highlighting = buffer.getHighlighting();
@@ -160,27 +128,25 @@ Vec drawBuffer(Buffer& buffer, const Vec& pos, const Vec& size, bool prompt = fa
         size_t lineCursor = 0;
 
         // reset fg color before each line
-        setFgColor(control::sgr::resetFgColor);
+        screen.setFgColor("");
 
-        background.set(Background::Normal);
+        setBackground(Background::Normal);
 
-        if (l > firstLine && pos.x > 0) // moving by 0 would still move 1 (default)
-            terminal::bufferWrite(control::moveCursorForward(pos.x));
+        screen.moveCursor(Vec { pos.x, pos.y + l - firstLine });
 
         if (showLineNumbers) {
-            invert.set(true);
-            terminal::bufferWrite(' '); // left margin
+            setInvert(true);
+            screen.write(' '); // left margin
             const auto lineStr = std::to_string(l + 1);
-            for (size_t i = 0; i < lineNumDigits - lineStr.size(); ++i)
-                terminal::bufferWrite(' ');
-            terminal::bufferWrite(lineStr);
-            terminal::bufferWrite(' '); // right margin
+            screen.write(' ', lineNumDigits - lineStr.size());
+            screen.write(lineStr);
+            screen.write(' '); // right margin
         }
-        invert.set(false);
+        setInvert(false);
 
         const auto lineBg
             = highlightCurrentLine && cursorInLine ? Background::CurrentLine : Background::Normal;
-        background.set(lineBg);
+        setBackground(lineBg);
 
         const auto cursorX = buffer.getCursorX(cursor);
 
@@ -200,32 +166,32 @@ Vec drawBuffer(Buffer& buffer, const Vec& pos, const Vec& size, bool prompt = fa
                 const auto inHighlight = i >= curHighlight.start && i < curHighlight.end;
 
                 if (inHighlight) {
-                    setFgColor(highlighting->getColor(curHighlight.id));
+                    screen.setFgColor(highlighting->getColor(curHighlight.id));
                 } else {
-                    setFgColor(control::sgr::resetFgColor);
+                    screen.setFgColor("");
                 }
             }
 
             const bool moveCursor = cursorInLine && i - line.offset < cursorX;
 
             const bool selected = selection.contains(i);
-            invert.set(selected);
+            setInvert(selected);
 
             if (!prompt && !selected && i >= highlightSelectionUntil && matchSelection(i))
                 highlightSelectionUntil = i + selectionStr.size();
 
-            background.set(i < highlightSelectionUntil ? Background::Highlight : lineBg);
+            setBackground(i < highlightSelectionUntil ? Background::Highlight : lineBg);
 
             if (ch == ' ' && config.renderWhitespace && !config.whitespace.space.empty()) {
                 // If whitespace is not rendered, this will fall into "else"
-                setFgColor(whitespaceColor);
-                terminal::bufferWrite(config.whitespace.space);
+                screen.setFgColor(whitespaceColor);
+                screen.write(config.whitespace.space);
 
                 lineCursor++;
                 if (moveCursor)
                     drawCursor.x++;
             } else if (ch == '\t') {
-                setFgColor(whitespaceColor);
+                screen.setFgColor(whitespaceColor);
                 const bool tabChars = !config.whitespace.tabStart.empty()
                     || !config.whitespace.tabMid.empty() || !config.whitespace.tabEnd.empty();
                 assert(buffer.tabWidth > 0);
@@ -243,17 +209,17 @@ Vec drawBuffer(Buffer& buffer, const Vec& pos, const Vec& size, bool prompt = fa
                     else
                         tabStr = std::string(buffer.tabWidth, ' ');
                 }
-                terminal::bufferWrite(tabStr);
+                screen.write(tabStr);
 
                 lineCursor += tabStr.size();
                 if (moveCursor)
                     drawCursor.x += tabStr.size();
             } else if (std::iscntrl(ch)) {
-                setFgColor(whitespaceColor);
+                screen.setFgColor(whitespaceColor);
                 auto str = getControlString(ch);
                 if (lineCursor + str.size() > textWidth)
                     str = str.substr(0, textWidth - lineCursor);
-                terminal::bufferWrite(str);
+                screen.write(str);
 
                 lineCursor += str.size();
                 if (moveCursor)
@@ -261,8 +227,10 @@ Vec drawBuffer(Buffer& buffer, const Vec& pos, const Vec& size, bool prompt = fa
             } else {
                 const auto len = utf8::getCodePointLength(text, text.getSize(), i);
 
+                char codePoint[4];
                 for (size_t j = 0; j < len; ++j)
-                    terminal::bufferWrite(text[i + j]);
+                    codePoint[j] = text[i + j];
+                screen.write(std::string_view(codePoint, len));
                 i += len - 1; // -1, because we i++ from the for loop anyway
 
                 // Always assume each code point is one character on screen
@@ -277,48 +245,42 @@ Vec drawBuffer(Buffer& buffer, const Vec& pos, const Vec& size, bool prompt = fa
         }
 
         // background for newline
-        invert.set(selection.contains(i));
-        background.set(i < highlightSelectionUntil ? Background::Highlight : lineBg);
+        setInvert(selection.contains(i));
+        setBackground(i < highlightSelectionUntil ? Background::Highlight : lineBg);
 
         // The index will be < size but not \n only if we didn't draw the whole line
         const bool drawNewline = config.renderWhitespace && !config.whitespace.newline.empty()
             && lineCursor < textWidth && (i < text.getSize() && text[i] == '\n');
         if (drawNewline) {
-            setFgColor(whitespaceColor);
-            terminal::bufferWrite(config.whitespace.newline);
+            screen.setFgColor(whitespaceColor);
+            screen.write(config.whitespace.newline);
         }
 
         // reset after line
-        invert.set(false);
-        background.set(lineBg);
-        setFgColor(control::sgr::resetFgColor);
+        setInvert(false);
+        setBackground(lineBg);
+        screen.setFgColor("");
 
         if (highlightCurrentLine && cursorInLine) {
             const auto numSpaces
                 = subClamp(subClamp(textWidth, lineCursor), drawNewline ? 1ul : 0ul);
-            for (size_t i = 0; i < numSpaces; ++i)
-                terminal::bufferWrite(' ');
+            screen.write(' ', numSpaces);
         }
 
-        terminal::bufferWrite(control::clearLine);
-        if (l - firstLine < size.y - 1)
-            terminal::bufferWrite("\r\n");
+        screen.clearLine();
     }
 
-    background.set(Background::Normal);
+    setBackground(Background::Normal);
 
-    for (size_t y = lastLine + 1; y < size.y; ++y) {
-        if (pos.x > 0)
-            terminal::bufferWrite(control::moveCursorForward(pos.x));
-        terminal::bufferWrite("~");
+    for (size_t y = lastLine - firstLine + 1; y < size.y; ++y) {
+        screen.moveCursor(Vec { pos.x, pos.y + y });
+        screen.write('~');
         if (text.getSize() == 0 && y == size.y / 2) {
             const auto str = "Empty File"sv;
-            terminal::bufferWrite(std::string(size.x / 2 - str.size() / 2, ' '));
-            terminal::bufferWrite(str);
+            screen.write(' ', size.x / 2 - str.size() / 2);
+            screen.write(str);
         }
-        terminal::bufferWrite(control::clearLine);
-        if (y < size.y - 1)
-            terminal::bufferWrite("\r\n");
+        screen.clearLine();
     }
 
     return drawCursor;
@@ -328,7 +290,7 @@ void drawStatusBar(const Buffer& buffer, const Vec& terminalSize)
 {
     static const auto pid = getpid();
 
-    terminal::bufferWrite(std::string(control::sgr::bgColorPrefix) + colorScheme["background"]);
+    screen.setBgColor(colorScheme["background"]);
 
     assert(buffer.indentation.type == Indentation::Type::Spaces
         || buffer.indentation.type == Indentation::Type::Tabs);
@@ -350,11 +312,11 @@ void drawStatusBar(const Buffer& buffer, const Vec& terminalSize)
     status.append(subClamp(subClamp(terminalSize.x - 1, status.size()), infoSize), ' ');
     status.append(std::string_view(info).substr(0, infoSize));
 
-    terminal::bufferWrite(control::sgr::invert);
-    terminal::bufferWrite(status);
-    terminal::bufferWrite(control::sgr::resetInvert);
-    terminal::bufferWrite(control::clearLine);
-    terminal::bufferWrite("\r\n");
+    screen.setAttribute(Screen::Attribute::Invert);
+    screen.write(status);
+    screen.setAttribute(Screen::Attribute::Invert, false);
+    screen.clearLine();
+    screen.newline();
 }
 
 size_t getNumPromptOptions()
@@ -365,85 +327,73 @@ size_t getNumPromptOptions()
 Vec drawPrompt(const Vec& terminalSize)
 {
     enum class Background { Normal = 0, CurrentLine, Highlight };
-    LazyMappedTerminalState<Background> background({
-        std::string(control::sgr::bgColorPrefix) + colorScheme["background"],
-        std::string(control::sgr::bgColorPrefix) + colorScheme["highlight.currentline"],
-        std::string(control::sgr::bgColorPrefix) + colorScheme["highlight.match.prompt"],
-    });
+    const std::array<std::string_view, 3> backgrounds {
+        colorScheme["background"],
+        colorScheme["highlight.currentline"],
+        colorScheme["highlight.match.prompt"],
+    };
+    auto setBackground = [&backgrounds](Background bg) {
+        screen.setBgColor(backgrounds[static_cast<size_t>(bg)]);
+    };
+    setBackground(Background::Normal);
 
     const auto numOptions = getNumPromptOptions();
-    const auto& options = currentPrompt->getOptions();
     if (numOptions > 0) {
         const auto selected = currentPrompt->getSelectedOption();
-        const auto skip = std::min(currentPrompt->getNumMatchingOptions() - numOptions,
+        const auto first = std::min(currentPrompt->getNumMatchingOptions() - numOptions,
             selected >= numOptions / 2 ? selected - (numOptions - 1) / 2 : 0);
 
-        auto skipToNextMatching = [](const std::vector<Prompt::Option>& opts, size_t& index) {
-            index++;
-            while (index < opts.size() && opts[index].score == 0)
-                index++;
-        };
-
-        size_t index = 0;
-        if (options[index].score == 0)
-            skipToNextMatching(options, index);
-
-        for (size_t i = 0; i < skip; ++i)
-            skipToNextMatching(options, index);
-        assert(index < options.size());
-
-        for (size_t n = 0; n < numOptions; ++n) {
-            assert(index < options.size());
-            const bool isSelected = index == selected;
+        // The best match is at the bottom, right above the input
+        for (size_t n = numOptions; n-- > 0;) {
+            const auto rank = first + n;
+            const bool isSelected = rank == selected;
             const auto bg = isSelected ? Background::CurrentLine : Background::Normal;
-            background.set(bg);
+            setBackground(bg);
 
-            const auto& opt = options[index];
+            const auto& opt = currentPrompt->getMatchingOption(rank);
+            // matchedCharacters are byte offsets, but we write whole code points
+            const auto& matched = opt.matchedCharacters;
             size_t matchIndex = 0;
-            for (size_t c = 0; c < opt.str.size(); ++c) {
-                if (matchIndex < opt.matchedCharacters.size()
-                    && c == opt.matchedCharacters[matchIndex]) {
-                    background.set(Background::Highlight);
+            size_t c = 0;
+            while (c < opt.str.size()) {
+                const auto len = std::min(utf8::getCodePointLength(opt.str[c]), opt.str.size() - c);
+                const auto isMatched = matchIndex < matched.size() && matched[matchIndex] < c + len;
+                while (matchIndex < matched.size() && matched[matchIndex] < c + len)
                     matchIndex++;
-                } else {
-                    background.set(bg);
-                }
-                terminal::bufferWrite(opt.str[c]);
+                setBackground(isMatched ? Background::Highlight : bg);
+                screen.write(std::string_view(opt.str).substr(c, len));
+                c += len;
             }
 
-            background.set(bg);
-            terminal::bufferWrite(control::clearLine);
-            terminal::bufferWrite("\r\n");
-
-            skipToNextMatching(options, index);
+            setBackground(bg);
+            screen.clearLine();
+            screen.newline();
         }
-        background.set(Background::Normal);
-    } else if (!options.empty()) {
-        terminal::bufferWrite("No matches");
-        terminal::bufferWrite(control::clearLine);
-        terminal::bufferWrite("\r\n");
+        setBackground(Background::Normal);
+    } else if (!currentPrompt->getOptions().empty()) {
+        screen.write("No matches");
+        screen.clearLine();
+        screen.newline();
     } else if (!currentPrompt->getUpdateMessage().empty()) {
-        terminal::bufferWrite(currentPrompt->getUpdateMessage());
-        terminal::bufferWrite(control::clearLine);
-        terminal::bufferWrite("\r\n");
+        screen.write(currentPrompt->getUpdateMessage());
+        screen.clearLine();
+        screen.newline();
     }
 
     const auto& prompt = currentPrompt->prompt;
-    terminal::bufferWrite(prompt);
+    screen.write(prompt);
     assert(currentPrompt->input.getText().getLineCount() == 1);
     const auto pos = Vec { prompt.size(), terminalSize.y - 1 };
     const auto size = Vec { terminalSize.x - prompt.size(), 1 };
-    const auto drawCursor = drawBuffer(currentPrompt->input, pos, size, true);
-    terminal::bufferWrite(control::clearLine);
-    return drawCursor;
+    return drawBuffer(currentPrompt->input, pos, size, true);
 }
 
 void redraw()
 {
-    terminal::bufferWrite(control::hideCursor);
-    terminal::bufferWrite(control::resetCursor);
-
     const auto size = terminal::getSize();
+    screen.resize(size);
+    screen.clear();
+
     // At least one line for "No matches" if there are options and maybe an update message
     const auto promptHeight = []() {
         if (currentPrompt) {
@@ -459,9 +409,9 @@ void redraw()
     const auto bufferPos = Vec { 0, 0 };
     const auto bufferSize = Vec { size.x, size.y - 2 - promptHeight };
     auto drawCursor = drawBuffer(getBuffer(), bufferPos, bufferSize);
-    terminal::bufferWrite("\r\n");
 
-    terminal::write(control::moveCursor(Vec { bufferPos.x, bufferPos.y + bufferSize.y }));
+    screen.moveCursor(Vec { bufferPos.x, bufferPos.y + bufferSize.y });
+    screen.resetStyle();
     drawStatusBar(getBuffer(), size);
 
     if (currentPrompt) {
@@ -469,26 +419,60 @@ void redraw()
     } else {
         switch (statusMessage.type) {
         case StatusMessage::Type::Normal:
-            terminal::bufferWrite(control::sgr::resetFgColor);
+            screen.setFgColor("");
             break;
         case StatusMessage::Type::Error:
-            terminal::bufferWrite(control::sgr::fgColorPrefix);
-            terminal::bufferWrite(colorScheme["error.prompt"]);
+            screen.setFgColor(colorScheme["error.prompt"]);
             break;
         }
-        terminal::bufferWrite(statusMessage.message);
-        terminal::bufferWrite(control::clearLine);
+        screen.write(statusMessage.message);
+        screen.clearLine();
     }
 
-    terminal::bufferWrite(control::moveCursor(drawCursor));
-    terminal::bufferWrite(control::showCursor);
-    terminal::flushWrite();
+    screen.flush(drawCursor);
+}
+
+namespace {
+    void drawFrame()
+    {
+        redrawScheduled = false;
+        lastFrameStart = Clock::now();
+        redraw();
+
+        const auto frameTime = std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - lastFrameStart);
+        frameStats.frames++;
+        frameStats.lastFrameTime = frameTime;
+        frameStats.maxFrameTime = std::max(frameStats.maxFrameTime, frameTime);
+        frameStats.totalFrameTime += frameTime;
+    }
 }
 
 void triggerRedraw()
 {
-    static CustomEvent event = getEventHandler().addCustomHandler([] { editor::redraw(); }).second;
-    event.emit();
+    static CustomEvent event = getEventHandler().addCustomHandler([] { drawFrame(); }).second;
+
+    if (redrawScheduled)
+        return;
+    redrawScheduled = true;
+
+    const auto maxFps = std::max(Config::get().maxFps, 1ul);
+    const auto frameInterval = std::chrono::microseconds(1'000'000 / maxFps);
+    const auto sinceLastFrame = Clock::now() - lastFrameStart;
+    if (sinceLastFrame >= frameInterval) {
+        // Even if we may draw right away, we wait for the rest of this event loop iteration, so
+        // everything that happens in it ends up in the same frame.
+        event.emit();
+    } else {
+        const auto wait
+            = std::chrono::ceil<std::chrono::milliseconds>(frameInterval - sinceLastFrame);
+        getEventHandler().addTimer(0, wait.count(), [] { drawFrame(); });
+    }
+}
+
+const FrameStats& getFrameStats()
+{
+    return frameStats;
 }
 
 void setReadOnly()
@@ -575,10 +559,12 @@ Prompt::Prompt(std::string_view prompt, std::function<ConfirmCallback> confirmCa
     : prompt(prompt)
     , confirmCallback_(confirmCallback)
 {
-    for (size_t i = 0; i < options.size(); ++i)
-        options_.push_back(Option { i, options[i] });
-    if (!options_.empty())
-        selectedOption_ = options_.size() - 1;
+    options_.reserve(options.size());
+    charMasks_.reserve(options.size());
+    for (const auto& str : options) {
+        options_.push_back(Option { str });
+        charMasks_.push_back(fuzzy::getCharMask(str));
+    }
 }
 
 Prompt::Prompt(std::string_view prompt, std::function<ConfirmCallback> confirmCallback,
@@ -589,80 +575,327 @@ Prompt::Prompt(std::string_view prompt, std::function<ConfirmCallback> confirmCa
 {
 }
 
+Prompt::Prompt(Prompt&& other)
+    : input(std::move(other.input))
+    , prompt(std::move(other.prompt))
+    , confirmCallback_(std::move(other.confirmCallback_))
+    , updateCallback_(std::move(other.updateCallback_))
+    , updateMessage_(std::move(other.updateMessage_))
+    , options_(std::move(other.options_))
+    , charMasks_(std::move(other.charMasks_))
+    , filters_(std::move(other.filters_))
+    , optionsMutex_(std::move(other.optionsMutex_))
+    , pendingOptions_(std::move(other.pendingOptions_))
+    , sortedMatches_(other.sortedMatches_)
+    , selectedOption_(other.selectedOption_)
+{
+    if (other.scoring_) {
+        other.stopScoring();
+        rankOptions();
+    }
+}
+
+Prompt::~Prompt()
+{
+    stopScoring();
+    // Wait for the workers that did not notice they are cancelled yet
+    if (optionsMutex_)
+        std::unique_lock lock(*optionsMutex_);
+}
+
 void Prompt::update()
 {
-    const auto inputStr = input.getText().getString();
-    if (inputStr.empty()) {
-        for (auto& opt : options_)
-            opt.score = 1; // so they are considered matching
+    rankOptions();
+    if (updateCallback_)
+        updateMessage_ = updateCallback_(this);
+}
+
+void Prompt::addOptions(std::vector<std::string> options)
+{
+    // If the selection was moved away from the best match, keep it on the same option
+    const auto keepSelection = selectedOption_ > 0;
+    const auto selected = keepSelection ? getMatches()[selectedOption_].index : 0;
 
-        // So the order they were passed to the prompt initially is kept
-        std::stable_sort(options_.begin(), options_.end(),
-            [](const Option& a, const Option& b) { return a.originalIndex < b.originalIndex; });
+    // options_ can't change while it's scored. They are added when it's done.
+    if (scoring_) {
+        pendingOptions_.insert(pendingOptions_.end(), std::make_move_iterator(options.begin()),
+            std::make_move_iterator(options.end()));
+        return;
+    }
 
-        selectedOption_ = options_.size() - 1;
-    } else {
-        for (auto& opt : options_)
-            opt.score = fuzzyMatchScore(inputStr, opt.str, &opt.matchedCharacters);
+    const auto firstNew = options_.size();
+    {
+        // Cancelled workers might still be running
+        std::unique_lock lock(*optionsMutex_);
+        options_.reserve(options_.size() + options.size());
+        charMasks_.reserve(charMasks_.size() + options.size());
+        for (auto& str : options) {
+            charMasks_.push_back(fuzzy::getCharMask(str));
+            options_.push_back(Option { std::move(str) });
+        }
+    }
+    if (filters_.empty()) {
+        rankOptions();
+        return;
+    }
+
+    // Add the new options to the cached filters too. If one does not match a query, it does not
+    // match the longer ones either.
+    for (size_t i = firstNew; i < options_.size(); ++i) {
+        for (auto& filter : filters_) {
+            if (!filter.matcher.mayMatch(charMasks_[i]))
+                break;
+            const auto score = filter.matcher.score(options_[i].str);
+            if (score == fuzzy::NoMatch)
+                break;
+            filter.matches.push_back(Match { score, i });
+        }
+    }
+    sortedMatches_ = 0;
+    selectedOption_ = 0;
+    sortMatches(Config::get().numPromptOptions);
+
+    if (keepSelection) {
+        auto& matches = getMatches();
+        const auto it = std::find_if(matches.begin(), matches.end(),
+            [selected](const Match& m) { return m.index == selected; });
+        if (it != matches.end()) {
+            const auto match = *it;
+            const auto rank = static_cast<size_t>(std::count_if(matches.begin(), matches.end(),
+                [&match](const Match& m) { return isBetter(m, match); }));
+            sortMatches(rank + Config::get().numPromptOptions);
+            selectedOption_ = rank;
+        }
+    }
+}
 
-        std::stable_sort(options_.begin(), options_.end(),
-            [](const Option& a, const Option& b) { return a.score < b.score; });
+// Equal scores keep the order of the options, but the last one is the best (like it's selected
+// when the input is empty)
+bool Prompt::isBetter(const Match& a, const Match& b)
+{
+    return a.score != b.score ? a.score > b.score : a.index > b.index;
+}
+
+void Prompt::rankOptions(bool parallel)
+{
+    // If the previous input is still being scored, it's not needed anymore
+    stopScoring();
 
-        // It's sorted, so if the last one is score = 0, they all are.
-        const auto anyMatching = !options_.empty() && options_.back().score > 0;
-        selectedOption_ = anyMatching ? options_.size() - 1 : 0;
+    fuzzy::Matcher matcher(input.getText().getString());
+    const auto& query = matcher.getQuery();
+
+    // Drop the filters for the characters that were deleted (or changed)
+    const auto isPrefix = [&query](const Filter& filter) {
+        const auto& prefix = filter.matcher.getQuery();
+        return query.compare(0, prefix.size(), prefix) == 0;
+    };
+    while (!filters_.empty() && !isPrefix(filters_.back()))
+        filters_.pop_back();
+
+    if (filters_.empty()) {
+        std::vector<Match> all;
+        all.reserve(options_.size());
+        for (size_t i = 0; i < options_.size(); ++i)
+            all.push_back(Match { 0, i });
+        filters_.push_back(Filter { fuzzy::Matcher(), std::move(all) });
     }
 
-    if (updateCallback_)
-        updateMessage_ = updateCallback_(this);
+    // Below this it's faster to just do it, than to wait for the workers
+    static constexpr size_t minParallelCandidates = 16 * 1024;
+    if (filters_.back().matcher.getQuery() != query && parallel
+        && filters_.back().matches.size() >= minParallelCandidates) {
+        startScoring(std::move(matcher));
+    } else if (filters_.back().matcher.getQuery() != query) {
+        // Only the options that matched the shorter query can match this one
+        std::vector<Match> matches;
+        for (const auto& candidate : filters_.back().matches) {
+            const auto i = candidate.index;
+            if (!matcher.mayMatch(charMasks_[i]))
+                continue;
+            const auto score = matcher.score(options_[i].str);
+            if (score != fuzzy::NoMatch)
+                matches.push_back(Match { score, i });
+        }
+        filters_.push_back(Filter { std::move(matcher), std::move(matches) });
+    }
+
+    sortedMatches_ = 0;
+    selectedOption_ = 0;
+    sortMatches(Config::get().numPromptOptions);
+
+    // If scoring was stopped before it was done
+    if (!scoring_ && !pendingOptions_.empty())
+        addOptions(std::exchange(pendingOptions_, {}));
+}
+
+void Prompt::sortMatches(size_t count)
+{
+    auto& matches = getMatches();
+    if (count <= sortedMatches_ || sortedMatches_ == matches.size())
+        return;
+    // Sort a few more, so we don't do this for every step when scrolling through them
+    count = std::min(std::max(count, 2 * sortedMatches_), matches.size());
+    std::partial_sort(
+        matches.begin() + sortedMatches_, matches.begin() + count, matches.end(), isBetter);
+    updateMatchedCharacters(sortedMatches_, count);
+    sortedMatches_ = count;
+}
+
+// Only the ones that are displayed need the matched characters
+void Prompt::updateMatchedCharacters(size_t begin, size_t end)
+{
+    const auto& matches = getMatches();
+    const auto& matcher = filters_.back().matcher;
+    for (size_t i = begin; i < end; ++i) {
+        auto& opt = options_[matches[i].index];
+        matcher.score(opt.str, &opt.matchedCharacters);
+    }
+}
+
+void Prompt::startScoring(fuzzy::Matcher matcher)
+{
+    scoring_ = std::make_shared<Scoring>();
+    scoring_->matcher = std::move(matcher);
+    // The candidates are copied, because the current matches are sorted while this is running
+    // and the filter might be popped. The first one has all the options.
+    const auto& candidates = filters_.back().matches;
+    if (filters_.size() > 1) {
+        scoring_->candidates.reserve(candidates.size());
+        for (const auto& candidate : candidates)
+            scoring_->candidates.push_back(candidate.index);
+    }
+
+    const auto numCandidates = candidates.size();
+    const auto numChunks = std::max(1u, std::thread::hardware_concurrency());
+    const auto chunkSize = (numCandidates + numChunks - 1) / numChunks;
+    scoring_->results.resize(numChunks);
+    scoring_->numRunning = numChunks;
+    scoringJobs_.resize(numChunks);
+    for (size_t c = 0; c < numChunks; ++c) {
+        const auto begin = std::min(c * chunkSize, numCandidates);
+        const auto end = std::min(begin + chunkSize, numCandidates);
+        auto work = [scoring = scoring_, mutex = optionsMutex_, options = options_.data(),
+                        charMasks = charMasks_.data(), numBest = Config::get().numPromptOptions,
+                        c, begin, end](const std::atomic<bool>& cancelled) {
+            std::shared_lock lock(*mutex);
+            // Checked after locking, so the prompt can't be gone
+            if (cancelled.load())
+                return;
+            const auto& matcher = scoring->matcher;
+            auto& matches = scoring->results[c];
+            for (size_t i = begin; i < end; ++i) {
+                if (i % 1024 == 0 && cancelled.load())
+                    return;
+                const auto index = scoring->candidates.empty() ? i : scoring->candidates[i];
+                if (!matcher.mayMatch(charMasks[index]))
+                    continue;
+                const auto score = matcher.score(options[index].str);
+                if (score != fuzzy::NoMatch)
+                    matches.push_back(Match { score, index });
+            }
+            const auto best = std::min(numBest, matches.size());
+            std::partial_sort(matches.begin(), matches.begin() + best, matches.end(), isBetter);
+        };
+        const auto id = getEventHandler().addJob(std::move(work), [this, c] {
+            scoringJobs_[c].release();
+            if (--scoring_->numRunning == 0)
+                scoringDone();
+        });
+        scoringJobs_[c].reset(&getEventHandler(), id);
+    }
+}
+
+void Prompt::scoringDone()
+{
+    const auto scoring = std::move(scoring_);
+    scoringJobs_.clear();
+
+    // The best ones of every chunk are sorted, so they only need to be merged and the rest just
+    // has to come after them
+    const auto numBest = Config::get().numPromptOptions;
+    auto& results = scoring->results;
+    std::vector<size_t> merged(results.size(), 0);
+    size_t numMatches = 0;
+    for (const auto& r : results)
+        numMatches += r.size();
+    std::vector<Match> matches;
+    matches.reserve(numMatches);
+    while (matches.size() < numBest) {
+        auto best = results.size();
+        for (size_t c = 0; c < results.size(); ++c) {
+            if (merged[c] == std::min(numBest, results[c].size()))
+                continue;
+            const auto& match = results[c][merged[c]];
+            if (best == results.size() || isBetter(match, results[best][merged[best]]))
+                best = c;
+        }
+        if (best == results.size())
+            break;
+        matches.push_back(results[best][merged[best]++]);
+    }
+    for (size_t c = 0; c < results.size(); ++c)
+        matches.insert(matches.end(), results[c].begin() + merged[c], results[c].end());
+
+    filters_.push_back(Filter { std::move(scoring->matcher), std::move(matches) });
+    selectedOption_ = 0;
+    sortedMatches_ = std::min(numBest, getMatches().size());
+    updateMatchedCharacters(0, sortedMatches_);
+
+    if (!pendingOptions_.empty())
+        addOptions(std::exchange(pendingOptions_, {}));
+    triggerRedraw();
+}
+
+void Prompt::stopScoring()
+{
+    // Removing the jobs cancels them
+    scoringJobs_.clear();
+    scoring_.reset();
+}
+
+std::vector<Prompt::Match>& Prompt::getMatches()
+{
+    assert(!filters_.empty());
+    return filters_.back().matches;
+}
+
+const std::vector<Prompt::Match>& Prompt::getMatches() const
+{
+    assert(!filters_.empty());
+    return filters_.back().matches;
 }
 
 std::optional<StatusMessage> Prompt::confirm()
 {
+    // Don't confirm an option of a shorter input
+    if (scoring_)
+        rankOptions(false);
     if (options_.empty()) {
         return confirmCallback_(input.getText().getString());
     } else {
-        if (getNumMatchingOptions() > 0) {
-            assert(options_[selectedOption_].score > 0);
-            return confirmCallback_(options_[selectedOption_].str);
-        }
+        if (getNumMatchingOptions() > 0)
+            return confirmCallback_(options_[getMatches()[selectedOption_].index].str);
         return std::nullopt;
     }
 }
 
 void Prompt::selectUp()
 {
-    // This handles the care where we don't need to do anything and where there are no matching
-    // options (or where options is empty)
-    if (selectedOption_ > 0) {
-        // the check is wrap around
-        for (size_t i = selectedOption_ - 1; i < selectedOption_; --i) {
-            if (options_[i].score > 0) {
-                selectedOption_ = i;
-                break;
-            }
-        }
+    if (selectedOption_ + 1 < getNumMatchingOptions()) {
+        selectedOption_++;
+        sortMatches(selectedOption_ + Config::get().numPromptOptions);
     }
 }
 
 void Prompt::selectDown()
 {
-    // If the selected is not matching, none are
-    if (options_.empty() || options_[selectedOption_].score == 0)
-        return;
-
-    for (size_t i = selectedOption_ + 1; i < options_.size(); ++i) {
-        if (options_[i].score > 0) {
-            selectedOption_ = i;
-            break;
-        }
-    }
+    if (selectedOption_ > 0)
+        selectedOption_--;
 }
 
 size_t Prompt::getNumMatchingOptions() const
 {
-    return std::count_if(
-        options_.begin(), options_.end(), [](const Option& o) { return o.score > 0; });
+    return filters_.empty() ? 0 : getMatches().size();
 }
 
 const std::vector<Prompt::Option>& Prompt::getOptions() const
@@ -670,6 +903,12 @@ const std::vector<Prompt::Option>& Prompt::getOptions() const
     return options_;
 }
 
+const Prompt::Option& Prompt::getMatchingOption(size_t rank) const
+{
+    assert(rank < sortedMatches_);
+    return options_[getMatches()[rank].index];
+}
+
 size_t Prompt::getSelectedOption() const
 {
     return selectedOption_;
@@ -680,6 +919,11 @@ const std::string& Prompt::getUpdateMessage() const
     return updateMessage_;
 }
 
+void Prompt::setUpdateMessage(std::string message)
+{
+    updateMessage_ = std::move(message);
+}
+
 Prompt* getPrompt()
 {
     return currentPrompt.get();
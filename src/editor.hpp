@@ -1,11 +1,15 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
 
 #include "buffer.hpp"
+#include "eventhandler.hpp"
+#include "fuzzy.hpp"
 #include "terminal.hpp"
 
 namespace editor {
@@ -16,12 +20,18 @@ struct StatusMessage {
     Type type = Type::Normal;
 };
 
+struct FrameStats {
+    size_t frames = 0;
+    std::chrono::microseconds lastFrameTime { 0 };
+    std::chrono::microseconds maxFrameTime { 0 };
+    std::chrono::microseconds totalFrameTime { 0 };
+};
+
 struct Prompt {
 public:
     struct Option {
-        size_t originalIndex;
         std::string str;
-        size_t score = 0;
+        // Only for the matching options that are sorted (see getMatchingOption)
         std::vector<size_t> matchedCharacters = {};
     };
 
@@ -35,24 +45,90 @@ public:
         const std::vector<std::string>& options);
     Prompt(std::string_view prompt, std::function<ConfirmCallback> confirmCallback,
         std::function<UpdateCallback> updateCallback = nullptr);
+    // The scoring jobs point to the prompt, so if other is scoring, it's stopped and this one
+    // starts again
+    Prompt(Prompt&& other);
+    ~Prompt();
 
     size_t getNumMatchingOptions() const;
     const std::vector<Option>& getOptions() const;
+    // rank 0 is the best match. Only the ranks up to getSelectedOption() + numPromptOptions are
+    // sorted, so only those may be passed.
+    const Option& getMatchingOption(size_t rank) const;
+    // The rank of the selected option
     size_t getSelectedOption() const;
     const std::string& getUpdateMessage() const;
+    // For update callbacks that finish later
+    void setUpdateMessage(std::string message);
 
     void update();
+    // For options that are found later (e.g. while walking a directory)
+    void addOptions(std::vector<std::string> options);
     std::optional<StatusMessage> confirm();
     void selectUp();
     void selectDown();
 
 private:
+    struct Match {
+        fuzzy::Score score;
+        size_t index; // into options_
+    };
+
+    // The matches for a query. Every option that matches a query also matches all of its
+    // prefixes, so when a character is appended, only the matches of the previous query need to
+    // be scored again.
+    struct Filter {
+        fuzzy::Matcher matcher;
+        std::vector<Match> matches;
+    };
+
+    // Scoring a lot of candidates is split into contiguous chunks, which are scored on the worker
+    // threads. Every chunk has its own results, so they don't need to synchronize, and they are
+    // merged on the main thread when all of them are done.
+    struct Scoring {
+        fuzzy::Matcher matcher;
+        // Indices into options_. If it's empty, all options are candidates.
+        std::vector<size_t> candidates;
+        // One per chunk, with the best ones sorted at the front
+        std::vector<std::vector<Match>> results;
+        size_t numRunning = 0;
+    };
+
+    static bool isBetter(const Match& a, const Match& b);
+    // If there are many candidates and parallel is true, this only starts scoring and the current
+    // matches are the ones of the longest prefix of the input, until it's done.
+    void rankOptions(bool parallel = true);
+    void startScoring(fuzzy::Matcher matcher);
+    void scoringDone();
+    void stopScoring();
+    // Makes sure the first count matches are sorted
+    void sortMatches(size_t count);
+    void updateMatchedCharacters(size_t begin, size_t end);
+    std::vector<Match>& getMatches();
+    const std::vector<Match>& getMatches() const;
+
     std::function<ConfirmCallback> confirmCallback_;
     std::function<UpdateCallback> updateCallback_ = nullptr;
     // A message that can be returned by the update callback and will be displayed above the prompt
     std::string updateMessage_;
     std::vector<Option> options_;
-    // This always points at a matching option. If there are no (matching) options, it's 0
+    // See fuzzy::getCharMask. Separate from options_, so the first pass over all of them only
+    // touches these.
+    std::vector<uint64_t> charMasks_;
+    // One for every prefix of the input we have seen, starting with the empty one (all options).
+    // The last one is for the current input. Deleting characters goes back to the cached ones.
+    std::vector<Filter> filters_;
+    std::shared_ptr<Scoring> scoring_;
+    std::vector<ScopedHandlerHandle> scoringJobs_;
+    // The workers read options_ and charMasks_ without any other synchronization, so they hold
+    // this shared while they run and it's held exclusively to change them or destroy the prompt.
+    std::shared_ptr<std::shared_mutex> optionsMutex_ = std::make_shared<std::shared_mutex>();
+    // Options that were added while scoring
+    std::vector<std::string> pendingOptions_;
+    // Only the first sortedMatches_ of the current matches are sorted, because only a few are
+    // displayed
+    size_t sortedMatches_ = 0;
+    // An index into the current matches. If there are no matching options, it's 0.
     size_t selectedOption_ = 0;
 };
 
@@ -68,7 +144,10 @@ Buffer& getBuffer(size_t index = 0);
 void closeBuffer(size_t index = 0);
 
 void redraw();
+// This does not redraw immediately, but merges all calls until the next redraw. It also makes sure
+// we redraw at most Config::maxFps times per second.
 void triggerRedraw();
+const FrameStats& getFrameStats();
 
 void setStatusMessage(
     const std::string& message, StatusMessage::Type type = StatusMessage::Type::Normal);
@@ -49,6 +49,12 @@ EventHandler::HandlerId EventHandler::addFilesystemHandler(
     return impl_->addFilesystemHandler(path, callback);
 }
 
+EventHandler::HandlerId EventHandler::addFilesystemHandler(
+    const fs::path& dirPath, std::function<void(const FilesystemEvent&)> callback)
+{
+    return impl_->addFilesystemHandler(dirPath, callback);
+}
+
 EventHandler::HandlerId EventHandler::addFdHandler(int fd, std::function<void()> callback)
 {
     return impl_->addFdHandler(fd, callback);
@@ -60,6 +66,12 @@ std::pair<EventHandler::HandlerId, CustomEvent> EventHandler::addCustomHandler(
     return impl_->addCustomHandler(callback);
 }
 
+EventHandler::HandlerId EventHandler::addJob(
+    std::function<void(const std::atomic<bool>& cancelled)> work, std::function<void()> done)
+{
+    return impl_->addJob(std::move(work), std::move(done));
+}
+
 void EventHandler::removeHandler(HandlerId handle)
 {
     impl_->removeHandler(handle);
@@ -100,8 +112,11 @@ ScopedHandlerHandle::ScopedHandlerHandle(ScopedHandlerHandle&& other)
 
 ScopedHandlerHandle& ScopedHandlerHandle::operator=(ScopedHandlerHandle&& other)
 {
-    eventHandler_ = other.eventHandler_;
-    id_ = other.release();
+    if (this != &other) {
+        reset();
+        eventHandler_ = other.eventHandler_;
+        id_ = other.release();
+    }
     return *this;
 }
 
@@ -5,6 +5,7 @@
 #include <functional>
 #include <memory>
 #include <queue>
+#include <string>
 
 // We don't actually need this header here, but I want the signals to be included with this header
 #include <signal.h>
@@ -28,6 +29,15 @@ private:
     std::unique_ptr<CustomEventImpl> impl_;
 };
 
+// A change to the entries of a watched directory
+struct FilesystemEvent {
+    enum class Type { Created, Removed, Modified, Overflow };
+
+    Type type;
+    std::string name; // empty for Overflow
+    bool isDir = false;
+};
+
 class EventHandler {
 public:
     using HandlerId = size_t;
@@ -37,12 +47,24 @@ public:
 
     HandlerId addSignalHandler(int signum, std::function<void()> callback);
 
+    // Both are in milliseconds. The callback is first called after expiration (if it's 0, after
+    // interval) and then every interval. If interval is 0, the timer only fires once and is
+    // removed automatically afterwards (you may still call removeHandler with it's id).
     HandlerId addTimer(uint64_t interval, uint64_t expiration, std::function<void()> callback);
 
     // Currently only notifies if a file was modified
     HandlerId addFilesystemHandler(const fs::path& path, std::function<void()> callback);
 
-    // Currently only notifies if an fd is readable, because that's all I need
+    // For directories: Notifies if an entry was created, removed (renames are both) or written.
+    // If the kernel had to drop events, every directory handler gets an Overflow event.
+    // Returns InvalidHandlerId if the directory can't be watched and errno is set (ENOSPC if there
+    // are too many watches).
+    HandlerId addFilesystemHandler(
+        const fs::path& dirPath, std::function<void(const FilesystemEvent&)> callback);
+
+    // Currently only notifies if an fd is readable, because that's all I need.
+    // This is edge-triggered, so the callback has to read everything that is available. Otherwise
+    // it will not be called again until more data arrives.
     HandlerId addFdHandler(int fd, std::function<void()> callback);
 
     // When you call emit on the CustomEvent returned, the callback will be called in the next
@@ -50,6 +72,14 @@ public:
     // once.
     std::pair<HandlerId, CustomEvent> addCustomHandler(std::function<void()> callback);
 
+    // work is called on a worker thread and done is called on the main thread after it finished.
+    // Removing the handler cancels the job: done will not be called and if work did not start yet,
+    // it won't. If it is running already, cancelled is set, so it can return early.
+    // After done was called, the handler is removed automatically.
+    HandlerId addJob(
+        std::function<void(const std::atomic<bool>& cancelled)> work, std::function<void()> done);
+
+    // Removing a handler that doesn't exist (anymore) does nothing
     void removeHandler(HandlerId handle);
 
     void run(); // blocks until terminate is called
@@ -1,15 +1,56 @@
 #include "eventhandler_linux.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
 #include <limits.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/inotify.h>
 #include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 #include "debug.hpp"
 
+namespace {
+constexpr uint64_t nsPerMs = 1000 * 1000;
+constexpr uint64_t nsPerS = 1000 * nsPerMs;
+
+// These are stored in the epoll event data instead of a handler id
+constexpr auto inotifyEventId = EventHandler::InvalidHandlerId - 1;
+constexpr auto timerEventId = EventHandler::InvalidHandlerId - 2;
+constexpr auto jobEventId = EventHandler::InvalidHandlerId - 3;
+
+uint64_t getMonotonicTime()
+{
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * nsPerS + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+std::optional<FilesystemEvent::Type> getDirEventType(uint32_t mask)
+{
+    if (mask & (IN_CREATE | IN_MOVED_TO))
+        return FilesystemEvent::Type::Created;
+    if (mask & (IN_DELETE | IN_MOVED_FROM))
+        return FilesystemEvent::Type::Removed;
+    if (mask & IN_CLOSE_WRITE)
+        return FilesystemEvent::Type::Modified;
+    return std::nullopt;
+}
+
+// Everything is edge-triggered, so we always have to read until there is nothing left
+void drain(int fd, size_t size)
+{
+    char buf[sizeof(signalfd_siginfo)];
+    assert(size <= sizeof(buf));
+    while (::read(fd, buf, size) > 0) {
+    }
+}
+}
+
 CustomEventImpl::CustomEventImpl(int fd)
     : fd_(fd)
 {
@@ -22,13 +63,41 @@ void CustomEventImpl::emit() const
 }
 
 EventHandlerImpl::EventHandlerImpl()
-    : inotifyFd(::inotify_init())
+    : epollFd(::epoll_create1(EPOLL_CLOEXEC))
+    , inotifyFd(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+    , timerFd(::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+    , jobFd(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
 {
+    if (epollFd < 0) {
+        std::perror("epoll_create1");
+        std::exit(1);
+    }
     if (inotifyFd < 0) {
-        std::perror("inotify_init");
+        std::perror("inotify_init1");
+        std::exit(1);
+    }
+    if (timerFd < 0) {
+        std::perror("timerfd_create");
+        std::exit(1);
+    }
+    if (jobFd < 0) {
+        std::perror("eventfd");
         std::exit(1);
     }
-    pollFds.push_back(pollfd { inotifyFd, POLLIN, 0 });
+    addEpollFd(inotifyFd, inotifyEventId);
+    addEpollFd(timerFd, timerEventId);
+    addEpollFd(jobFd, jobEventId);
+}
+
+EventHandlerImpl::~EventHandlerImpl()
+{
+    for (auto& slot : slots_) {
+        if (!slot.handler)
+            continue;
+        if (const auto jh = std::get_if<JobHandler>(&*slot.handler))
+            jh->cancelled->store(true);
+    }
+    // threadPool_ is destroyed first and joins the workers
 }
 
 EventHandlerImpl::HandlerId EventHandlerImpl::addSignalHandler(
@@ -50,7 +119,7 @@ EventHandlerImpl::HandlerId EventHandlerImpl::addSignalHandler(
         std::exit(1);
     }
 
-    const auto fd = ::signalfd(-1, &sigset, 0);
+    const auto fd = ::signalfd(-1, &sigset, SFD_NONBLOCK | SFD_CLOEXEC);
     if (fd < 0) {
         std::perror("signalfd");
         std::exit(1);
@@ -59,9 +128,16 @@ EventHandlerImpl::HandlerId EventHandlerImpl::addSignalHandler(
 }
 
 EventHandlerImpl::HandlerId EventHandlerImpl::addTimer(
-    uint64_t /*interval*/, uint64_t /*expiration*/, std::function<void()> /*callback*/)
+    uint64_t interval, uint64_t expiration, std::function<void()> callback)
 {
-    return 0;
+    const auto id = addHandler(TimerHandler { callback, interval * nsPerMs });
+    const auto delay = (expiration > 0 ? expiration : interval) * nsPerMs;
+    const auto time = getMonotonicTime() + delay;
+    const auto earliest = timerQueue_.empty() || time < timerQueue_.top().time;
+    timerQueue_.push(TimerExpiration { time, id });
+    if (earliest)
+        updateTimerFd();
+    return id;
 }
 
 EventHandlerImpl::HandlerId EventHandlerImpl::addFilesystemHandler(
@@ -72,20 +148,42 @@ EventHandlerImpl::HandlerId EventHandlerImpl::addFilesystemHandler(
     debug("add watch: {} ({})", path.c_str(), wd);
     if (wd < 0) {
         perror("inotify_add_watch");
-        return 1;
+        return EventHandler::InvalidHandlerId;
+    }
+    const auto id = addHandler(FilesystemHandler { callback, path, wd, IN_ALL_EVENTS, nullptr });
+    // If the same file is watched twice, inotify returns the same wd. The last one wins.
+    wdMap_[wd] = id;
+    return id;
+}
+
+EventHandlerImpl::HandlerId EventHandlerImpl::addFilesystemHandler(
+    const fs::path& dirPath, std::function<void(const FilesystemEvent&)> callback)
+{
+    // Not IN_ALL_EVENTS, because we don't want to hear about every file that is opened
+    constexpr uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE
+        | IN_ONLYDIR | IN_EXCL_UNLINK;
+    const auto wd = ::inotify_add_watch(inotifyFd, dirPath.c_str(), mask);
+    if (wd < 0) {
+        // Running out of watches is expected for huge trees, so this is not an error
+        const auto error = errno;
+        debug("inotify_add_watch {}: {}", dirPath.c_str(), strerror(error));
+        errno = error; // for the caller
+        return EventHandler::InvalidHandlerId;
     }
-    return addHandlerWd(FilesystemHandler { callback, path, wd }, wd);
+    const auto id = addHandler(FilesystemHandler { nullptr, dirPath, wd, mask, callback });
+    wdMap_[wd] = id;
+    return id;
 }
 
 EventHandlerImpl::HandlerId EventHandlerImpl::addFdHandler(int fd, std::function<void()> callback)
 {
-    return addHandlerFd(FdHandler { callback }, fd);
+    return addHandlerFd(FdHandler { callback, fd }, fd);
 }
 
 std::pair<EventHandlerImpl::HandlerId, CustomEvent> EventHandlerImpl::addCustomHandler(
     std::function<void()> callback)
 {
-    const auto fd = ::eventfd(0, 0);
+    const auto fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
     if (fd < 0) {
         std::perror("eventfd");
         std::exit(1);
@@ -95,175 +193,354 @@ std::pair<EventHandlerImpl::HandlerId, CustomEvent> EventHandlerImpl::addCustomH
         id, CustomEvent(std::make_unique<CustomEventImpl>(fd)));
 }
 
+EventHandlerImpl::HandlerId EventHandlerImpl::addJob(
+    std::function<void(const std::atomic<bool>& cancelled)> work, std::function<void()> done)
+{
+    if (!threadPool_)
+        threadPool_ = std::make_unique<ThreadPool>();
+
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    const auto id = addHandler(JobHandler { std::move(done), cancelled });
+    threadPool_->push([this, id, work = std::move(work), cancelled = std::move(cancelled)] {
+        if (!cancelled->load())
+            work(*cancelled);
+        // Even if it was cancelled, because it's cheap and easier than checking again
+        {
+            std::lock_guard lock(finishedJobsMutex_);
+            finishedJobs_.push_back(id);
+        }
+        const uint64_t value = 1;
+        ::write(jobFd, &value, sizeof(value));
+    });
+    return id;
+}
+
 void EventHandlerImpl::removeHandler(HandlerId id)
 {
-    const auto index = handlerIdMap_.at(id);
-    if (const auto fh = std::get_if<FilesystemHandler>(&handlers_[index])) {
+    const auto handler = getHandler(id);
+    if (!handler) // i.e. a one-shot timer that already fired
+        return;
+
+    if (const auto fh = std::get_if<FilesystemHandler>(handler)) {
         debug("delete watch: {}", fh->wd);
-        wdMap_.erase(fh->wd);
-        ::inotify_rm_watch(inotifyFd, fh->wd);
+        const auto it = wdMap_.find(fh->wd);
+        if (it != wdMap_.end() && it->second == id) {
+            wdMap_.erase(it);
+            ::inotify_rm_watch(inotifyFd, fh->wd);
+        }
+    } else if (std::holds_alternative<TimerHandler>(*handler)) {
+        // It will be skipped when it's popped from timerQueue_
+    } else if (const auto jh = std::get_if<JobHandler>(handler)) {
+        // The worker will still report it as finished, but we won't find the handler anymore
+        jh->cancelled->store(true);
     } else {
-        const auto fdIt = std::find_if(fdMap_.begin(), fdMap_.end(),
-            [index](const auto& elem) { return elem.second == index; });
-        assert(fdIt != fdMap_.end());
-        const auto fd = fdIt->first;
-        const auto pfdIt = std::find_if(
-            pollFds.begin(), pollFds.end(), [fd](const auto& pfd) { return pfd.fd == fd; });
-        assert(pfdIt != pollFds.end());
-        pollFds.erase(pfdIt);
+        int fd = -1;
+        if (const auto sh = std::get_if<SignalHandler>(handler))
+            fd = sh->fd;
+        else if (const auto fdh = std::get_if<FdHandler>(handler))
+            fd = fdh->fd;
+        else if (const auto ch = std::get_if<CustomHandler>(handler))
+            fd = ch->fd;
+        // Closing the fd would remove it from the epoll set too, but FdHandler doesn't own it
+        ::epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
     }
-    handlers_.erase(handlers_.begin() + index);
-    handlerIdMap_.erase(id);
+
+    const auto index = static_cast<uint32_t>(id & 0xffffffff);
+    slots_[index].handler.reset();
+    slots_[index].generation++;
+    freeSlots_.push_back(index);
 }
 
 void EventHandlerImpl::processEvents()
 {
-    const auto ret = poll(&pollFds[0], pollFds.size(), -1);
-    if (ret < 0) {
-        std::perror("poll");
+    static constexpr int maxEvents = 64;
+    epoll_event events[maxEvents];
+    const auto num = ::epoll_wait(epollFd, events, maxEvents, -1);
+    if (num < 0) {
+        // Some signal we don't have a handler for (e.g. SIGCONT, SIGTSTP)
+        if (errno == EINTR)
+            return;
+        std::perror("epoll_wait");
         std::exit(1);
     }
-    if (ret == 0)
-        return;
 
-    // We need to first collect all the handlers we want to call and then call them, so
-    // it's possible for them to remove handlers (so pollFds doesn't change during iteration).
-    // We save the ids so if a handler is removed, it's not called during this call of
-    // processEvents. Future you, you wanted to collect the callbacks itself and if you did, they
-    // would still be called.
+    // A handler might remove other handlers (or itself) while we are still processing the events.
+    // Because we only look up the handler right before calling it and ids of removed handlers are
+    // never reused, those events are simply skipped.
     // Example: If a callback (i.e. input - Ctrl-W) closes a buffer and you
     // remove the filesystem watch, you want the filesystem watch to not be called anymore
     // (potentially with a dangling pointer).
-    std::vector<int> fds;
-    fds.reserve(pollFds.size());
-    for (const auto& pfd : pollFds) {
-        if (pfd.revents & POLLIN)
-            fds.push_back(pfd.fd);
+    for (int i = 0; i < num; ++i) {
+        const auto id = events[i].data.u64;
+        if (id == timerEventId) {
+            drain(timerFd, sizeof(uint64_t));
+            processTimers();
+        } else if (id == inotifyEventId) {
+            processInotify();
+        } else if (id == jobEventId) {
+            drain(jobFd, sizeof(uint64_t));
+            processJobs();
+        } else {
+            const auto handler = getHandler(id);
+            if (!handler) // handler was removed
+                continue;
+            // Copy the callback, because it might remove it's own handler
+            std::function<void()> callback;
+            if (const auto sh = std::get_if<SignalHandler>(handler)) {
+                drain(sh->fd, sizeof(signalfd_siginfo));
+                callback = sh->callback;
+            } else if (const auto fdh = std::get_if<FdHandler>(handler)) {
+                callback = fdh->callback;
+            } else if (const auto ch = std::get_if<CustomHandler>(handler)) {
+                drain(ch->fd, sizeof(uint64_t));
+                callback = ch->callback;
+            } else {
+                assert(false && "Invalid variant state");
+            }
+            callback();
+        }
     }
+}
 
-    for (const auto fd : fds) {
-        if (fd == inotifyFd) {
-            // If there are even more events, we'll get 'em later
-            static constexpr auto eventBufLen = 16 * (sizeof(inotify_event) + NAME_MAX + 1);
-            static char eventBuffer[eventBufLen];
+void EventHandlerImpl::processInotify()
+{
+    static constexpr auto eventBufLen = 16 * (sizeof(inotify_event) + NAME_MAX + 1);
+    alignas(inotify_event) static char eventBuffer[eventBufLen];
 
-            std::vector<int> wdsIgnored;
+    // Collect the ids first and call them later, so the callbacks may remove handlers
+    std::vector<HandlerId> modified;
+    std::vector<std::pair<HandlerId, FilesystemEvent>> dirEvents;
+    bool overflow = false;
+    std::vector<int> wdsIgnored;
+    while (true) {
+        const auto len = ::read(inotifyFd, eventBuffer, eventBufLen);
+        if (len < 0 && errno != EAGAIN) {
+            perror("read");
+            std::exit(1);
+        }
+        if (len <= 0)
+            break;
+        debug("read {} from inotify fd", len);
 
-            const auto len = ::read(inotifyFd, eventBuffer, eventBufLen);
-            if (len < 0 && errno != EAGAIN) {
-                perror("read");
-                std::exit(1);
-            }
-            debug("read {} from inotify fd", len);
-
-            long i = 0;
-            while (i < len) {
-                const auto event = reinterpret_cast<inotify_event*>(&eventBuffer[i]);
-                debug("wd: {}, mask: {}", event->wd, event->mask);
-                if (event->mask & IN_ACCESS)
-                    debug("IN_ACCESS");
-                if (event->mask & IN_MODIFY)
-                    debug("IN_MODIFY");
-                if (event->mask & IN_ATTRIB)
-                    debug("IN_ATTRIB");
-                if (event->mask & IN_CLOSE_WRITE)
-                    debug("IN_CLOSE_WRITE");
-                if (event->mask & IN_CLOSE_NOWRITE)
-                    debug("IN_CLOSE_NOWRITE");
-                if (event->mask & IN_OPEN)
-                    debug("IN_OPEN");
-                if (event->mask & IN_MOVED_FROM)
-                    debug("IN_MOVED_FROM");
-                if (event->mask & IN_MOVED_TO)
-                    debug("IN_MOVED_TO");
-                if (event->mask & IN_CREATE)
-                    debug("IN_CREATE");
-                if (event->mask & IN_DELETE)
-                    debug("IN_DELETE");
-                if (event->mask & IN_DELETE_SELF)
-                    debug("IN_DELETE_SELF");
-                if (event->mask & IN_MOVE_SELF)
-                    debug("IN_MOVE_SELF");
-                if (event->mask & IN_UNMOUNT)
-                    debug("IN_UNMOUNT");
-                if (event->mask & IN_Q_OVERFLOW)
-                    debug("IN_Q_OVERFLOW");
-                if (event->mask & IN_IGNORED)
-                    debug("IN_IGNORED");
-                if (event->len > 0)
-                    debug("name: {}", std::string_view(event->name, event->len));
-                // len = 0, name empty, cookie unused
-                const auto it = wdMap_.find(event->wd);
-                if (it != wdMap_.end()) { // == end => handler was probably removed
+        long i = 0;
+        while (i < len) {
+            const auto event = reinterpret_cast<inotify_event*>(&eventBuffer[i]);
+            debug("wd: {}, mask: {}", event->wd, event->mask);
+            if (event->mask & IN_ACCESS)
+                debug("IN_ACCESS");
+            if (event->mask & IN_MODIFY)
+                debug("IN_MODIFY");
+            if (event->mask & IN_ATTRIB)
+                debug("IN_ATTRIB");
+            if (event->mask & IN_CLOSE_WRITE)
+                debug("IN_CLOSE_WRITE");
+            if (event->mask & IN_CLOSE_NOWRITE)
+                debug("IN_CLOSE_NOWRITE");
+            if (event->mask & IN_OPEN)
+                debug("IN_OPEN");
+            if (event->mask & IN_MOVED_FROM)
+                debug("IN_MOVED_FROM");
+            if (event->mask & IN_MOVED_TO)
+                debug("IN_MOVED_TO");
+            if (event->mask & IN_CREATE)
+                debug("IN_CREATE");
+            if (event->mask & IN_DELETE)
+                debug("IN_DELETE");
+            if (event->mask & IN_DELETE_SELF)
+                debug("IN_DELETE_SELF");
+            if (event->mask & IN_MOVE_SELF)
+                debug("IN_MOVE_SELF");
+            if (event->mask & IN_UNMOUNT)
+                debug("IN_UNMOUNT");
+            if (event->mask & IN_Q_OVERFLOW)
+                debug("IN_Q_OVERFLOW");
+            if (event->mask & IN_IGNORED)
+                debug("IN_IGNORED");
+            if (event->len > 0)
+                debug("name: {}", std::string_view(event->name, event->len));
+            if (event->mask & IN_Q_OVERFLOW)
+                overflow = true;
+            // len = 0, name empty, cookie unused
+            const auto it = wdMap_.find(event->wd);
+            if (it != wdMap_.end()) { // == end => handler was probably removed
+                const auto fh = std::get_if<FilesystemHandler>(getHandler(it->second));
+                if (fh && fh->dirCallback) {
+                    if (const auto type = getDirEventType(event->mask); type && event->len > 0)
+                        dirEvents.emplace_back(it->second,
+                            FilesystemEvent { *type, event->name, (event->mask & IN_ISDIR) != 0 });
+                } else if (event->mask & (IN_CLOSE_WRITE | IN_ATTRIB)) {
                     // vim `:w` generates: IN_MOVE_SELF, IN_ATTRIB, IN_DELETE_SELF, IN_IGNORED
                     // so I'll just interpret IN_ATTRIB as a modification too.
                     // I kind of want to reload on `touch` anyway.
-                    if (event->mask & (IN_CLOSE_WRITE | IN_ATTRIB)) {
-                        const auto fh = std::get_if<FilesystemHandler>(&handlers_[it->second]);
-                        assert(fh);
-                        fh->callback();
-                    }
-                    if (event->mask & IN_IGNORED) {
-                        wdsIgnored.push_back(event->wd);
-                    }
+                    modified.push_back(it->second);
                 }
-                i += sizeof(inotify_event) + event->len;
+                if (event->mask & IN_IGNORED)
+                    wdsIgnored.push_back(event->wd);
             }
+            i += sizeof(inotify_event) + event->len;
+        }
+    }
 
-            // Some programs write to a different file and rename, which deletes the old file,
-            // so we need to re-watch them.
-            for (const auto wd : wdsIgnored) {
-                const auto idx = wdMap_.at(wd);
-                const auto fh = std::get_if<FilesystemHandler>(&handlers_[idx]);
-                assert(fh);
-                ::inotify_rm_watch(inotifyFd, wd);
-                wdMap_.erase(wd);
-                fh->wd = ::inotify_add_watch(inotifyFd, fh->path.c_str(), IN_ALL_EVENTS);
-                wdMap_[fh->wd] = idx;
-            }
+    // Some programs write to a different file and rename, which deletes the old file,
+    // so we need to re-watch them.
+    for (const auto wd : wdsIgnored) {
+        const auto it = wdMap_.find(wd);
+        if (it == wdMap_.end())
+            continue;
+        const auto id = it->second;
+        const auto fh = std::get_if<FilesystemHandler>(getHandler(id));
+        assert(fh);
+        ::inotify_rm_watch(inotifyFd, wd);
+        wdMap_.erase(it);
+        fh->wd = ::inotify_add_watch(inotifyFd, fh->path.c_str(), fh->mask);
+        if (fh->wd >= 0)
+            wdMap_[fh->wd] = id;
+    }
+
+    for (const auto id : modified) {
+        // An earlier callback might have removed this handler
+        if (const auto fh = std::get_if<FilesystemHandler>(getHandler(id))) {
+            auto callback = fh->callback;
+            callback();
+        }
+    }
+
+    if (overflow) {
+        dirEvents.clear(); // They need to look at everything anyway
+        for (const auto& [wd, id] : wdMap_) {
+            const auto fh = std::get_if<FilesystemHandler>(getHandler(id));
+            if (fh && fh->dirCallback)
+                dirEvents.emplace_back(id, FilesystemEvent { FilesystemEvent::Type::Overflow, "" });
+        }
+    }
+    for (const auto& [id, event] : dirEvents) {
+        if (const auto fh = std::get_if<FilesystemHandler>(getHandler(id))) {
+            auto callback = fh->dirCallback;
+            callback(event);
+        }
+    }
+}
+
+void EventHandlerImpl::processJobs()
+{
+    std::vector<HandlerId> finished;
+    {
+        std::lock_guard lock(finishedJobsMutex_);
+        finished.swap(finishedJobs_);
+    }
+
+    for (const auto id : finished) {
+        // Cancelled jobs have been removed already
+        const auto jh = std::get_if<JobHandler>(getHandler(id));
+        if (!jh)
+            continue;
+        auto callback = std::move(jh->callback);
+        removeHandler(id);
+        callback();
+    }
+}
+
+void EventHandlerImpl::processTimers()
+{
+    // Collect first, so timers added by the callbacks are not called in this round
+    const auto now = getMonotonicTime();
+    std::vector<HandlerId> expired;
+    while (!timerQueue_.empty() && timerQueue_.top().time <= now) {
+        const auto exp = timerQueue_.top();
+        timerQueue_.pop();
+        const auto handler = getHandler(exp.id);
+        if (!handler) // removed
+            continue;
+        expired.push_back(exp.id);
+
+        const auto interval = std::get<TimerHandler>(*handler).interval;
+        if (interval > 0) {
+            // If we are late, skip the expirations we missed instead of firing for all of them
+            const auto missed = (now - exp.time) / interval;
+            timerQueue_.push(TimerExpiration { exp.time + (missed + 1) * interval, exp.id });
+        }
+    }
+
+    for (const auto id : expired) {
+        // An earlier callback might have removed this timer
+        const auto handler = getHandler(id);
+        if (!handler)
+            continue;
+        auto& th = std::get<TimerHandler>(*handler);
+        if (th.interval == 0) {
+            auto callback = std::move(th.callback);
+            removeHandler(id);
+            callback();
         } else {
-            const auto it = fdMap_.find(fd);
-            if (it == fdMap_.end()) // handler was probably removed
-                continue;
-            const auto& handler = handlers_[it->second];
-            if (const auto sh = std::get_if<SignalHandler>(&handler)) {
-                signalfd_siginfo info;
-                ::read(sh->fd, &info, sizeof(signalfd_siginfo));
-                sh->callback();
-            } else if (const auto fdh = std::get_if<FdHandler>(&handler)) {
-                fdh->callback();
-            } else if (const auto ch = std::get_if<CustomHandler>(&handler)) {
-                uint64_t val = 0;
-                ::read(ch->fd, &val, 8);
-                ch->callback();
-            } else {
-                assert(false && "Invalid variant state");
-            }
+            // Copy, because the callback might remove the timer
+            auto callback = th.callback;
+            callback();
         }
     }
+
+    updateTimerFd();
+}
+
+void EventHandlerImpl::updateTimerFd()
+{
+    while (!timerQueue_.empty() && !getHandler(timerQueue_.top().id))
+        timerQueue_.pop();
+
+    // it_value = 0 disarms the timer
+    itimerspec spec {};
+    if (!timerQueue_.empty()) {
+        // Since 0 would disarm it, make sure it's > 0. It's in the past anyways.
+        const auto time = std::max(timerQueue_.top().time, 1ul);
+        spec.it_value = timespec { static_cast<time_t>(time / nsPerS),
+            static_cast<long>(time % nsPerS) };
+    }
+    if (::timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+        std::perror("timerfd_settime");
+        std::exit(1);
+    }
 }
 
 EventHandlerImpl::HandlerId EventHandlerImpl::addHandler(Handler&& handler)
 {
-    const auto id = handlerIdCounter_++;
-    handlers_.push_back(std::forward<Handler>(handler));
-    handlerIdMap_[id] = handlers_.size() - 1;
-    return id;
+    uint32_t index = 0;
+    if (freeSlots_.empty()) {
+        index = static_cast<uint32_t>(slots_.size());
+        slots_.emplace_back();
+    } else {
+        index = freeSlots_.back();
+        freeSlots_.pop_back();
+    }
+    auto& slot = slots_[index];
+    slot.handler.emplace(std::move(handler));
+    return static_cast<HandlerId>(slot.generation) << 32 | index;
 }
 
 EventHandlerImpl::HandlerId EventHandlerImpl::addHandlerFd(Handler&& handler, int fd)
 {
     const auto id = addHandler(std::move(handler));
-    assert(fdMap_.count(fd) == 0);
-    fdMap_[fd] = handlers_.size() - 1;
-    pollFds.push_back(pollfd { fd, POLLIN, 0 });
+    addEpollFd(fd, id);
     return id;
 }
 
-EventHandlerImpl::HandlerId EventHandlerImpl::addHandlerWd(Handler&& handler, int wd)
+EventHandlerImpl::Handler* EventHandlerImpl::getHandler(HandlerId id)
 {
-    const auto id = addHandler(std::move(handler));
-    assert(wdMap_.count(wd) == 0);
-    wdMap_[wd] = handlers_.size() - 1;
-    return id;
+    const auto index = static_cast<uint32_t>(id & 0xffffffff);
+    const auto generation = static_cast<uint32_t>(id >> 32);
+    if (index >= slots_.size())
+        return nullptr;
+    auto& slot = slots_[index];
+    if (slot.generation != generation || !slot.handler)
+        return nullptr;
+    return &*slot.handler;
+}
+
+void EventHandlerImpl::addEpollFd(int fd, uint64_t data)
+{
+    epoll_event event {};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u64 = data;
+    if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        std::perror("epoll_ctl");
+        std::exit(1);
+    }
 }
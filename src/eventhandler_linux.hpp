@@ -1,12 +1,14 @@
 #pragma once
 
+#include <mutex>
+#include <optional>
+#include <queue>
 #include <unordered_map>
 #include <variant>
 
-#include <poll.h>
-
 #include "eventhandler.hpp"
 #include "fd.hpp"
+#include "threadpool.hpp"
 
 class CustomEventImpl {
 public:
@@ -23,6 +25,8 @@ public:
     using HandlerId = EventHandler::HandlerId;
 
     EventHandlerImpl();
+    // Cancels all jobs, so we only wait for the ones that are running to notice
+    ~EventHandlerImpl();
 
     HandlerId addSignalHandler(int signum, std::function<void()> callback);
 
@@ -30,10 +34,16 @@ public:
 
     HandlerId addFilesystemHandler(const fs::path& path, std::function<void()> callback);
 
+    HandlerId addFilesystemHandler(
+        const fs::path& dirPath, std::function<void(const FilesystemEvent&)> callback);
+
     HandlerId addFdHandler(int fd, std::function<void()> callback);
 
     std::pair<HandlerId, CustomEvent> addCustomHandler(std::function<void()> callback);
 
+    HandlerId addJob(
+        std::function<void(const std::atomic<bool>& cancelled)> work, std::function<void()> done);
+
     void removeHandler(HandlerId handle);
 
     void processEvents();
@@ -48,10 +58,13 @@ private:
         std::function<void()> callback;
         fs::path path; // I need to save it, so I can re-add when I get IN_IGNORED
         int wd;
+        uint32_t mask;
+        std::function<void(const FilesystemEvent&)> dirCallback; // only for directories
     };
 
     struct FdHandler {
         std::function<void()> callback;
+        int fd;
     };
 
     struct CustomHandler {
@@ -59,17 +72,65 @@ private:
         Fd fd;
     };
 
-    using Handler = std::variant<SignalHandler, FilesystemHandler, FdHandler, CustomHandler>;
+    // All timers share a single timerfd, which is always set to the earliest expiration
+    struct TimerHandler {
+        std::function<void()> callback;
+        uint64_t interval; // nanoseconds, 0 for one-shot timers
+    };
+
+    struct JobHandler {
+        std::function<void()> callback; // called when the job is done
+        std::shared_ptr<std::atomic<bool>> cancelled; // shared with the worker
+    };
+
+    struct TimerExpiration {
+        uint64_t time; // CLOCK_MONOTONIC in nanoseconds
+        HandlerId id;
+
+        bool operator>(const TimerExpiration& other) const
+        {
+            return time > other.time;
+        }
+    };
+
+    using Handler = std::variant<SignalHandler, FilesystemHandler, FdHandler, CustomHandler,
+        TimerHandler, JobHandler>;
+
+    // Handlers never move, so we can find (and remove) them in O(1). An id is the index of the
+    // slot and it's generation at the time the handler was added. The generation is incremented
+    // when a handler is removed, so old ids never refer to a new handler in the same slot.
+    // This is also what is stored in the epoll events, so if a handler is removed while we are
+    // processing events, its events are simply skipped.
+    struct Slot {
+        std::optional<Handler> handler;
+        uint32_t generation = 0;
+    };
 
     HandlerId addHandler(Handler&& handler);
     HandlerId addHandlerFd(Handler&& handler, int fd);
-    HandlerId addHandlerWd(Handler&& handler, int wd);
-
-    size_t handlerIdCounter_ = 0;
-    std::vector<Handler> handlers_;
-    std::unordered_map<HandlerId, size_t> handlerIdMap_;
-    std::unordered_map<int, size_t> fdMap_;
-    std::unordered_map<int, size_t> wdMap_;
-    std::vector<pollfd> pollFds;
+    Handler* getHandler(HandlerId id);
+    void addEpollFd(int fd, uint64_t data);
+
+    void processInotify();
+    void processJobs();
+    void processTimers();
+    void updateTimerFd();
+
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> freeSlots_;
+    std::unordered_map<int, HandlerId> wdMap_;
+    Fd epollFd;
     Fd inotifyFd;
+    Fd timerFd;
+    // Removing a timer does not remove it from here. We just skip the ids that don't exist anymore.
+    std::priority_queue<TimerExpiration, std::vector<TimerExpiration>,
+        std::greater<TimerExpiration>>
+        timerQueue_;
+    // All jobs share a single eventfd too. The workers push the ids of the finished jobs here.
+    Fd jobFd;
+    std::mutex finishedJobsMutex_;
+    std::vector<HandlerId> finishedJobs_;
+    // Created when the first job is added. This has to be last, so the threads are joined before
+    // anything they use is destroyed.
+    std::unique_ptr<ThreadPool> threadPool_;
 };
@@ -0,0 +1,488 @@
+#include "fileindex.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <optional>
+
+#include "config.hpp"
+#include "debug.hpp"
+#include "dirwalk.hpp"
+#include "util.hpp"
+
+namespace {
+// How often the files that the walk found are added while building
+constexpr uint64_t BuildUpdateInterval = 50; // ms
+// Changes usually come in bursts (e.g. git checkout), so we wait a little before we look
+constexpr uint64_t UpdateDelay = 100; // ms
+constexpr uint64_t SaveDelay = 10 * 1000; // ms
+
+constexpr std::string_view Magic = "exquisite file index 1\n";
+
+std::string getParent(std::string_view path)
+{
+    const auto slash = path.rfind('/');
+    return std::string(slash == std::string_view::npos ? "" : path.substr(0, slash));
+}
+
+fs::path getSavePath(const std::string& root)
+{
+    const auto hash = std::hash<std::string> {}(root);
+    return getConfigDirectory() / "fileindex" / hexString(&hash, sizeof(hash));
+}
+
+void writeVarint(std::string& out, size_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool readVarint(std::string_view data, size_t& pos, size_t& value)
+{
+    value = 0;
+    for (size_t shift = 0; pos < data.size() && shift < 64; shift += 7) {
+        const auto byte = static_cast<uint8_t>(data[pos++]);
+        value |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// The paths are sorted and each one is saved as the length of the prefix it shares with the one
+// before and the rest of it. Paths in the same directory share a lot, so this is pretty small.
+std::string encode(const std::string& root, std::vector<std::string> paths)
+{
+    std::sort(paths.begin(), paths.end());
+    std::string out(Magic);
+    out.append(root);
+    out.push_back('\n');
+    writeVarint(out, paths.size());
+    std::string_view last;
+    for (const auto& path : paths) {
+        const auto shared = static_cast<size_t>(
+            std::mismatch(last.begin(), last.end(), path.begin(), path.end()).first - last.begin());
+        writeVarint(out, shared);
+        writeVarint(out, path.size() - shared);
+        out.append(path, shared);
+        last = path;
+    }
+    return out;
+}
+
+std::optional<std::vector<std::string>> decode(std::string_view data, const std::string& root)
+{
+    const auto header = std::string(Magic) + root + "\n";
+    if (data.substr(0, header.size()) != header)
+        return std::nullopt;
+    size_t pos = header.size();
+    size_t count = 0;
+    if (!readVarint(data, pos, count))
+        return std::nullopt;
+
+    std::vector<std::string> paths;
+    paths.reserve(std::min(count, data.size())); // in case the file is garbage
+    for (size_t i = 0; i < count; ++i) {
+        size_t shared = 0, rest = 0;
+        if (!readVarint(data, pos, shared) || !readVarint(data, pos, rest))
+            return std::nullopt;
+        if (shared > (paths.empty() ? 0 : paths.back().size()) || rest > data.size() - pos)
+            return std::nullopt;
+        auto path = paths.empty() ? std::string() : paths.back().substr(0, shared);
+        path.append(data.substr(pos, rest));
+        pos += rest;
+        paths.push_back(std::move(path));
+    }
+    return paths;
+}
+
+// Writes to a temporary file first, so we never leave half a file behind
+bool writeFile(const fs::path& path, std::string_view data)
+{
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    const auto tmpPath = fs::path(path).concat(".tmp");
+    {
+        auto f = uniqueFopen(tmpPath.c_str(), "wb");
+        if (!f || fwrite(data.data(), 1, data.size(), f.get()) != data.size())
+            return false;
+    }
+    return ::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+}
+
+void FileIndex::start()
+{
+    if (started_) {
+        // Without the watches we don't know what changed
+        if (watchFailed_ && complete_ && !buildJob_.isValid())
+            build();
+        return;
+    }
+    started_ = true;
+    if (Config::get().persistFileIndex)
+        load();
+    build();
+}
+
+bool FileIndex::isComplete() const
+{
+    return complete_;
+}
+
+std::vector<std::string> FileIndex::getFiles() const
+{
+    const auto& dirs = streaming_ ? next_ : dirs_;
+    std::vector<std::string> files;
+    files.reserve(getFileCount());
+    for (const auto& [path, dir] : dirs)
+        files.insert(files.end(), dir.files.begin(), dir.files.end());
+    return files;
+}
+
+size_t FileIndex::getFileCount() const
+{
+    const auto& dirs = streaming_ ? next_ : dirs_;
+    size_t count = 0;
+    for (const auto& [path, dir] : dirs)
+        count += dir.files.size();
+    return count;
+}
+
+std::shared_ptr<FileIndex::Listener> FileIndex::addListener(Listener listener)
+{
+    auto ptr = std::make_shared<Listener>(std::move(listener));
+    listeners_.push_back(ptr);
+    return ptr;
+}
+
+bool FileIndex::load()
+{
+    const auto root = fs::current_path().u8string();
+    const auto data = readFile(getSavePath(root));
+    if (!data)
+        return false;
+    auto paths = decode(*data, root);
+    if (!paths) {
+        debug("Saved file index is invalid");
+        return false;
+    }
+    for (auto& path : *paths) {
+        auto& dir = dirs_[getParent(path)];
+        dir.files.push_back(std::move(path));
+    }
+    debug("Loaded {} files from the saved file index", paths->size());
+    return true;
+}
+
+void FileIndex::scheduleSave(uint64_t delay)
+{
+    if (!Config::get().persistFileIndex || saveTimer_.isValid())
+        return;
+    if (delay == 0) {
+        save();
+        return;
+    }
+    auto& eh = getEventHandler();
+    saveTimer_.reset(&eh, eh.addTimer(0, delay, [this] {
+        saveTimer_.release(); // one-shot timers are removed automatically
+        save();
+    }));
+}
+
+void FileIndex::save()
+{
+    if (saveJob_.isValid()) { // Try again when it's done
+        scheduleSave(SaveDelay);
+        return;
+    }
+    const auto root = fs::current_path().u8string();
+    const auto work = [root, path = getSavePath(root), files = getFiles()](
+                          const std::atomic<bool>&) mutable {
+        if (!writeFile(path, encode(root, std::move(files))))
+            debug("Could not save file index to {}", path.u8string());
+    };
+    auto& eh = getEventHandler();
+    saveJob_.reset(&eh, eh.addJob(work, [this] { saveJob_.release(); }));
+}
+
+void FileIndex::build()
+{
+    next_.clear();
+    // Otherwise we report the new files when we are done, so we don't report all of them twice
+    streaming_ = dirs_.empty();
+    addDir(next_, "");
+
+    walkResults_ = std::make_shared<WalkResults>();
+    auto success = std::make_shared<bool>(false);
+    const auto work = [results = walkResults_, success](const std::atomic<bool>& cancelled) {
+        const auto append
+            = [&results](std::vector<std::string>& dst, std::vector<std::string>& src) {
+            std::lock_guard lock(results->mutex);
+            dst.insert(dst.end(), std::make_move_iterator(src.begin()),
+                std::make_move_iterator(src.end()));
+        };
+        dirwalk::Options options;
+        options.dirCallback
+            = [&](std::vector<std::string>&& dirs) { append(results->dirs, dirs); };
+        *success = dirwalk::walk(
+            ".", [&](std::vector<std::string>&& files) { append(results->files, files); },
+            cancelled, options);
+    };
+    auto& eh = getEventHandler();
+    buildJob_.reset(&eh, eh.addJob(work, [this, success] { buildDone(*success); }));
+    buildTimer_.reset(
+        &eh, eh.addTimer(BuildUpdateInterval, BuildUpdateInterval, [this] { addWalkResults(); }));
+}
+
+void FileIndex::addWalkResults()
+{
+    std::vector<std::string> files;
+    std::vector<std::string> dirs;
+    {
+        std::lock_guard lock(walkResults_->mutex);
+        files.swap(walkResults_->files);
+        dirs.swap(walkResults_->dirs);
+    }
+    // The parents are always reported before their subdirectories
+    for (const auto& dir : dirs)
+        addDir(next_, dir);
+    for (const auto& file : files)
+        next_[getParent(file)].files.push_back(file);
+    if (streaming_)
+        notify(files);
+}
+
+void FileIndex::buildDone(bool success)
+{
+    buildJob_.release();
+    buildTimer_.reset();
+    addWalkResults();
+    if (!success) {
+        debug("Could not build file index");
+        next_.clear();
+        streaming_ = false;
+        return;
+    }
+
+    std::vector<std::string> added;
+    if (!streaming_) {
+        std::unordered_set<std::string_view> oldFiles;
+        for (const auto& [path, dir] : dirs_)
+            oldFiles.insert(dir.files.begin(), dir.files.end());
+        for (const auto& [path, dir] : next_) {
+            for (const auto& file : dir.files) {
+                if (!oldFiles.count(file))
+                    added.push_back(file);
+            }
+        }
+    }
+    dirs_ = std::move(next_);
+    next_.clear();
+    streaming_ = false;
+    complete_ = true;
+    debug("File index complete: {} files in {} directories", getFileCount(), dirs_.size());
+
+    notify(added);
+    // Something might have changed while we were walking
+    update();
+    scheduleSave(0);
+}
+
+void FileIndex::addDir(DirMap& dirs, const std::string& path)
+{
+    // References to elements of an unordered_map stay valid when other elements are inserted
+    auto& dir = dirs[path];
+    if (!path.empty())
+        dirs[getParent(path)].subdirs.push_back(path);
+    watch(dir, path);
+}
+
+void FileIndex::removeDir(const std::string& path)
+{
+    if (const auto parent = dirs_.find(getParent(path)); !path.empty() && parent != dirs_.end()) {
+        auto& subdirs = parent->second.subdirs;
+        subdirs.erase(std::remove(subdirs.begin(), subdirs.end(), path), subdirs.end());
+    }
+
+    std::vector<std::string> stack { path };
+    while (!stack.empty()) {
+        const auto it = dirs_.find(stack.back());
+        stack.pop_back();
+        if (it == dirs_.end())
+            continue;
+        stack.insert(stack.end(), it->second.subdirs.begin(), it->second.subdirs.end());
+        dirs_.erase(it);
+    }
+}
+
+// The directory might change between listing it and adding the watch. For new directories, the
+// watch is added first, but while building we accept that small window.
+bool FileIndex::watch(Dir& dir, const std::string& path)
+{
+    if (watchFailed_)
+        return false;
+    auto& eh = getEventHandler();
+    const auto id = eh.addFilesystemHandler(path.empty() ? "." : path,
+        [this, path](const FilesystemEvent& event) { dirChanged(path, event); });
+    if (id == EventHandler::InvalidHandlerId) {
+        // Anything else (e.g. no permission or it's gone already) only affects this directory. It
+        // is tried again when its parent is listed.
+        if (errno == ENOSPC) {
+            debug("Out of inotify watches, rebuilding the file index every time from now on");
+            watchFailed_ = true;
+            releaseWatches();
+        }
+        return false;
+    }
+    dir.watch.reset(&eh, id);
+    return true;
+}
+
+void FileIndex::releaseWatches()
+{
+    for (auto& [path, dir] : dirs_)
+        dir.watch.reset();
+    for (auto& [path, dir] : next_)
+        dir.watch.reset();
+}
+
+void FileIndex::dirChanged(const std::string& path, const FilesystemEvent& event)
+{
+    if (event.type == FilesystemEvent::Type::Overflow) {
+        rebuild_ = true;
+    } else if (event.name == ".gitignore" || event.name == ".ignore") {
+        // This might affect everything below, so we just start over
+        rebuild_ = true;
+    } else if (event.type != FilesystemEvent::Type::Modified) {
+        changedDirs_.insert(path);
+    } else {
+        return;
+    }
+    scheduleUpdate();
+}
+
+void FileIndex::scheduleUpdate()
+{
+    if (updateTimer_.isValid())
+        return;
+    auto& eh = getEventHandler();
+    updateTimer_.reset(&eh, eh.addTimer(0, UpdateDelay, [this] {
+        updateTimer_.release();
+        update();
+    }));
+}
+
+// The changed directories are listed again (not recursively). New subdirectories are watched
+// first and then listed in the next update, which starts right away.
+void FileIndex::update()
+{
+    // This is called again when they are done
+    if (!complete_ || buildJob_.isValid() || updateJob_.isValid())
+        return;
+
+    if (rebuild_) {
+        rebuild_ = false;
+        changedDirs_.clear();
+        build();
+        return;
+    }
+    if (changedDirs_.empty())
+        return;
+
+    std::vector<std::string> dirs(changedDirs_.begin(), changedDirs_.end());
+    changedDirs_.clear();
+    auto listings = std::make_shared<std::vector<Listing>>();
+    const auto work = [dirs = std::move(dirs), listings](const std::atomic<bool>& cancelled) {
+        for (const auto& dir : dirs) {
+            Listing listing;
+            listing.dir = dir;
+            const auto append = [](std::vector<std::string>& dst, std::vector<std::string>& src) {
+                dst.insert(dst.end(), std::make_move_iterator(src.begin()),
+                    std::make_move_iterator(src.end()));
+            };
+            dirwalk::Options options;
+            options.subdir = dir;
+            options.recursive = false;
+            options.dirCallback
+                = [&](std::vector<std::string>&& subdirs) { append(listing.subdirs, subdirs); };
+            listing.success = dirwalk::walk(
+                ".", [&](std::vector<std::string>&& files) { append(listing.files, files); },
+                cancelled, options);
+            listings->push_back(std::move(listing));
+        }
+    };
+    auto& eh = getEventHandler();
+    updateJob_.reset(&eh, eh.addJob(work, [this, listings] { updateDone(std::move(*listings)); }));
+}
+
+void FileIndex::updateDone(std::vector<Listing> listings)
+{
+    updateJob_.release();
+
+    std::vector<std::string> added;
+    for (auto& listing : listings) {
+        const auto it = dirs_.find(listing.dir);
+        if (it == dirs_.end()) // removed together with its parent
+            continue;
+        if (!listing.success) {
+            removeDir(listing.dir);
+            continue;
+        }
+
+        auto& dir = it->second;
+        const std::unordered_set<std::string> oldFiles(dir.files.begin(), dir.files.end());
+        for (const auto& file : listing.files) {
+            if (!oldFiles.count(file))
+                added.push_back(file);
+        }
+        dir.files = std::move(listing.files);
+
+        // addDir and removeDir update dir.subdirs
+        const std::unordered_set<std::string> subdirs(
+            listing.subdirs.begin(), listing.subdirs.end());
+        const auto oldSubdirs = dir.subdirs;
+        for (const auto& subdir : oldSubdirs) {
+            if (!subdirs.count(subdir))
+                removeDir(subdir);
+        }
+        for (const auto& subdir : listing.subdirs) {
+            const auto sub = dirs_.find(subdir);
+            if (sub == dirs_.end()) {
+                addDir(dirs_, subdir);
+                changedDirs_.insert(subdir);
+            } else if (!sub->second.watch.isValid() && watch(sub->second, subdir)) {
+                // It was not watched, so it might have changed
+                changedDirs_.insert(subdir);
+            }
+        }
+    }
+
+    notify(added);
+    update();
+    scheduleSave(SaveDelay);
+}
+
+void FileIndex::notify(const std::vector<std::string>& files)
+{
+    if (files.empty())
+        return;
+    // Copy, because a listener might add another one
+    std::vector<std::shared_ptr<Listener>> listeners;
+    for (const auto& listener : listeners_) {
+        if (auto ptr = listener.lock())
+            listeners.push_back(std::move(ptr));
+    }
+    listeners_.assign(listeners.begin(), listeners.end()); // drop the expired ones
+    for (const auto& listener : listeners)
+        (*listener)(files);
+}
+
+FileIndex& getFileIndex()
+{
+    static FileIndex index;
+    return index;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "eventhandler.hpp"
+
+// All the files in the working directory (as dirwalk lists them) for gotoFile and Find in Files.
+// It's built in the background the first time it's used and then kept up to date with an inotify
+// watch for every directory. If Config::persistFileIndex is set, the list is saved in the config
+// directory, so next time it can be used right away, while it's being rebuilt.
+// If we run out of inotify watches, all of them are released (so files can still be watched for
+// modifications) and the index is rebuilt every time it's used. Directories that can't be watched
+// for other reasons are only tried again when their parent changes.
+class FileIndex {
+public:
+    // Called on the main thread with the files that were added to the index
+    using Listener = std::function<void(const std::vector<std::string>& files)>;
+
+    // Loads the saved index and starts building it, if that's not done already
+    void start();
+    // True after the first walk is done. Until then the files might be from the saved index.
+    bool isComplete() const;
+    std::vector<std::string> getFiles() const;
+    size_t getFileCount() const;
+    // The listener is called with the files that are added to what getFiles returned, until the
+    // returned pointer is destroyed. Removed files are not reported.
+    std::shared_ptr<Listener> addListener(Listener listener);
+
+private:
+    struct Dir {
+        std::vector<std::string> files; // relative to the working directory
+        std::vector<std::string> subdirs;
+        ScopedHandlerHandle watch;
+    };
+    // "" is the working directory
+    using DirMap = std::unordered_map<std::string, Dir>;
+
+    // The output of the walk, collected on the worker threads
+    struct WalkResults {
+        std::mutex mutex;
+        std::vector<std::string> files;
+        std::vector<std::string> dirs;
+    };
+
+    // The output of listing the changed directories
+    struct Listing {
+        std::string dir;
+        bool success = false;
+        std::vector<std::string> files;
+        std::vector<std::string> subdirs;
+    };
+
+    bool load();
+    void scheduleSave(uint64_t delay);
+    void save();
+    void build();
+    void addWalkResults();
+    void buildDone(bool success);
+    void addDir(DirMap& dirs, const std::string& path);
+    void removeDir(const std::string& path);
+    // Returns false if it's not watched
+    bool watch(Dir& dir, const std::string& path);
+    void releaseWatches();
+    void dirChanged(const std::string& path, const FilesystemEvent& event);
+    void scheduleUpdate();
+    void update();
+    void updateDone(std::vector<Listing> listings);
+    void notify(const std::vector<std::string>& files);
+
+    bool started_ = false;
+    bool complete_ = false;
+    bool watchFailed_ = false;
+    bool rebuild_ = false; // after the next update
+    DirMap dirs_;
+    DirMap next_; // while building
+    bool streaming_ = false; // if the files are reported while building, because dirs_ is empty
+    std::shared_ptr<WalkResults> walkResults_;
+    ScopedHandlerHandle buildJob_;
+    ScopedHandlerHandle buildTimer_;
+    std::unordered_set<std::string> changedDirs_;
+    ScopedHandlerHandle updateTimer_;
+    ScopedHandlerHandle updateJob_;
+    ScopedHandlerHandle saveTimer_;
+    ScopedHandlerHandle saveJob_;
+    std::vector<std::weak_ptr<Listener>> listeners_;
+};
+
+FileIndex& getFileIndex();
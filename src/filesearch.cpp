@@ -0,0 +1,130 @@
+#include "filesearch.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <iterator>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "fd.hpp"
+#include "newline.hpp"
+#include "utf8.hpp"
+
+namespace {
+// Like git and grep, we only look for NUL bytes at the start
+constexpr size_t BinaryCheckSize = 8 * 1024;
+// So a minified file does not put megabytes of text into the results
+constexpr size_t MaxLineLength = 256;
+
+// Reads into buffer + n until it has size bytes or the file ends. Returns the new n.
+size_t readFull(int fd, char* buffer, size_t n, size_t size)
+{
+    while (n < size) {
+        const auto res = ::read(fd, buffer + n, size - n);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            break; // the file might have been truncated, we just search what we got
+        n += static_cast<size_t>(res);
+    }
+    return n;
+}
+
+// Calls func with the contents of the file. Returns false if it could not be read or is binary.
+template <typename Func>
+bool withFileContents(const std::string& path, std::string& readBuffer, Func&& func)
+{
+    Fd fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+        return false;
+    const auto size = static_cast<size_t>(st.st_size);
+
+    // Not mmap, because if the file is truncated while we search it (e.g. a log that is rotated),
+    // reading the mapping past the end raises SIGBUS, which would take the editor with it.
+    // The start is read first, so we don't read all of a huge binary file, just to skip it.
+    readBuffer.resize(std::min(size, BinaryCheckSize));
+    auto n = readFull(fd, readBuffer.data(), 0, readBuffer.size());
+    if (std::string_view(readBuffer.data(), n).find('\0') != std::string_view::npos)
+        return false;
+    if (n == BinaryCheckSize && size > n) {
+        readBuffer.resize(size);
+        n = readFull(fd, readBuffer.data(), n, size);
+    }
+    func(std::string_view(readBuffer.data(), n));
+    return true;
+}
+
+std::string_view getDisplayLine(std::string_view line)
+{
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+    if (line.size() > MaxLineLength) {
+        auto len = MaxLineLength;
+        while (len > 0 && utf8::isContinuationByte(line[len]))
+            len--;
+        line = line.substr(0, len);
+    }
+    return line;
+}
+
+void searchText(std::string_view path, std::string_view text, const search::Pattern& pattern,
+    filesearch::Result& result)
+{
+    size_t line = 0; // of lineStart
+    size_t lineStart = 0;
+    while (lineStart < text.size()) {
+        const auto match = pattern.find(text.substr(lineStart));
+        if (match == std::string_view::npos)
+            break;
+        const auto offset = lineStart + match;
+
+        // Only look at the text between the last line with a match and this one
+        const auto before = text.substr(lineStart, offset - lineStart);
+        line += newline::count(before);
+        const auto lastNewline = before.rfind('\n');
+        if (lastNewline != std::string_view::npos)
+            lineStart += lastNewline + 1;
+
+        auto lineEnd = text.find('\n', offset);
+        if (lineEnd == std::string_view::npos)
+            lineEnd = text.size();
+
+        const auto lineText = getDisplayLine(text.substr(lineStart, lineEnd - lineStart));
+        fmt::format_to(std::back_inserter(result.output), "{}:{}:{}: {}\n", path, line + 1,
+            offset - lineStart + 1, lineText);
+        result.matches++;
+
+        // One result per line, like grep
+        line++;
+        lineStart = lineEnd + 1;
+    }
+}
+}
+
+namespace filesearch {
+void searchFiles(const std::vector<std::string>& paths, const search::Pattern& pattern,
+    const std::atomic<bool>& cancelled, Result& result)
+{
+    std::string readBuffer;
+    for (const auto& path : paths) {
+        if (cancelled.load())
+            return;
+
+        const auto read = withFileContents(path, readBuffer, [&](std::string_view text) {
+            searchText(path, text, pattern, result);
+            result.files++;
+            result.bytes += text.size();
+        });
+        if (!read)
+            result.skipped++;
+    }
+}
+}
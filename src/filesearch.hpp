@@ -0,0 +1,26 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "search.hpp"
+
+// The part of Find in Files that runs on the worker threads, so nothing in here may touch the
+// editor. Files are read into a buffer that is reused and searched in place, without building a
+// TextBuffer for them.
+namespace filesearch {
+struct Result {
+    // A line "path:line:column: text" for every line with a match (like grep -n)
+    std::string output;
+    size_t files = 0; // that were searched
+    size_t skipped = 0; // binary or could not be read
+    size_t bytes = 0;
+    size_t matches = 0; // lines with a match
+};
+
+// Files with a NUL byte in the first few kilobytes are binary and skipped without searching them.
+// cancelled is checked between files.
+void searchFiles(const std::vector<std::string>& paths, const search::Pattern& pattern,
+    const std::atomic<bool>& cancelled, Result& result);
+}
@@ -1,29 +1,291 @@
 #include "fuzzy.hpp"
 
-#include "debug.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
 
-size_t fuzzyMatchScore(
-    std::string_view input, std::string_view str, std::vector<size_t>* matchedCharacters)
+// SSE2 is always there on x86-64, so unlike search and newline, this does not need to check
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+using fuzzy::Score;
+
+// The same as fzy's, but scaled to integers
+constexpr Score GapLeading = -1;
+constexpr Score GapTrailing = -1;
+constexpr Score GapInner = -2;
+constexpr Score MatchConsecutive = 200;
+constexpr Score MatchSlash = 180;
+constexpr Score MatchWord = 160;
+constexpr Score MatchCapital = 140;
+constexpr Score MatchDot = 120;
+
+// Low enough to never win and high enough that adding gaps to it does not overflow
+constexpr Score Impossible = std::numeric_limits<Score>::min() / 2;
+
+constexpr size_t npos = std::string_view::npos;
+
+constexpr char toLower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+constexpr char toUpper(char c)
+{
+    return c >= 'a' && c <= 'z' ? static_cast<char>(c - 'a' + 'A') : c;
+}
+
+// a-z and 0-9 get their own bit, everything else shares the rest
+constexpr std::array<uint64_t, 256> makeCharBits()
+{
+    std::array<uint64_t, 256> bits {};
+    for (size_t c = 0; c < 256; ++c) {
+        const auto lower = static_cast<uint8_t>(toLower(static_cast<char>(c)));
+        if (lower >= 'a' && lower <= 'z')
+            bits[c] = 1ull << (lower - 'a');
+        else if (lower >= '0' && lower <= '9')
+            bits[c] = 1ull << (26 + lower - '0');
+        else
+            bits[c] = 1ull << (36 + c % 28);
+    }
+    return bits;
+}
+
+constexpr auto charBits = makeCharBits();
+
+// Sets bit i of bits[q * stride] if block[i] is query[q] (ignoring case)
+void findInBlock(const char* block, std::string_view query, uint64_t* bits, size_t stride)
 {
-    if (matchedCharacters)
-        matchedCharacters->clear();
+#ifdef __SSE2__
+    __m128i chunks[4];
+    for (size_t i = 0; i < 4; ++i)
+        chunks[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+    for (size_t q = 0; q < query.size(); ++q) {
+        const auto lower = _mm_set1_epi8(query[q]);
+        const auto upper = _mm_set1_epi8(toUpper(query[q]));
+        uint64_t b = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            const auto eq
+                = _mm_or_si128(_mm_cmpeq_epi8(chunks[i], lower), _mm_cmpeq_epi8(chunks[i], upper));
+            b |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(eq))) << (16 * i);
+        }
+        bits[q * stride] = b;
+    }
+#else
+    for (size_t q = 0; q < query.size(); ++q) {
+        uint64_t b = 0;
+        for (size_t i = 0; i < 64; ++i)
+            b |= static_cast<uint64_t>(toLower(block[i]) == query[q]) << i;
+        bits[q * stride] = b;
+    }
+#endif
+}
 
-    size_t s = 0;
-    const auto max = std::numeric_limits<size_t>::max();
-    size_t score = max;
-    for (size_t i = 0; i < input.size(); ++i) {
-        size_t lastS = 0;
-        while (s < str.size() && std::tolower(str[s]) != std::tolower(input[i]))
-            s++;
-        if (s == str.size())
-            return 0;
+// Sets bit i % 64 of bits[q * numWords + i / 64] if str[i] is query[q] (ignoring case)
+void findAll(std::string_view str, std::string_view query, uint64_t* bits, size_t numWords)
+{
+    size_t i = 0;
+    for (; i + 64 <= str.size(); i += 64)
+        findInBlock(str.data() + i, query, bits++, numWords);
+    if (i < str.size()) {
+        // Zeros never match, because the query doesn't contain any
+        char block[64] = {};
+        std::memcpy(block, str.data() + i, str.size() - i);
+        findInBlock(block, query, bits, numWords);
+    }
+}
 
-        if (matchedCharacters)
-            matchedCharacters->push_back(s);
+// The first set bit at pos or later
+size_t nextBit(const uint64_t* bits, size_t numWords, size_t pos)
+{
+    auto word = pos / 64;
+    if (word >= numWords)
+        return npos;
+    auto w = bits[word] & (~0ull << (pos % 64));
+    while (!w) {
+        if (++word == numWords)
+            return npos;
+        w = bits[word];
+    }
+    return word * 64 + static_cast<size_t>(__builtin_ctzll(w));
+}
 
-        score -= s; // reduce the score for late matches
-        score -= s - lastS - 1; // reduce the score if this match is far apart from the last
-        lastS = s;
+// The last set bit at pos or earlier
+size_t prevBit(const uint64_t* bits, size_t pos)
+{
+    auto word = pos / 64;
+    auto w = bits[word] & (~0ull >> (63 - pos % 64));
+    while (!w) {
+        if (word-- == 0)
+            return npos;
+        w = bits[word];
+    }
+    return word * 64 + 63 - static_cast<size_t>(__builtin_clzll(w));
+}
+
+// For a match at str[i] after prev (or '/' at the start)
+Score getBonus(char prev, char cur)
+{
+    switch (prev) {
+    case '/':
+        return MatchSlash;
+    case '-':
+    case '_':
+    case ' ':
+        return MatchWord;
+    case '.':
+        return MatchDot;
+    default:
+        return prev >= 'a' && prev <= 'z' && cur >= 'A' && cur <= 'Z' ? MatchCapital : 0;
     }
-    return score;
+}
+
+// A possible match of a query character and the best score for the query up to it
+struct Cell {
+    size_t col;
+    Score score;
+};
+
+// The scratch space of score, so it does not allocate every time
+struct Scratch {
+    std::vector<uint64_t> bits;
+    std::vector<size_t> first;
+    std::vector<size_t> last;
+    std::vector<Cell> cells;
+    std::vector<size_t> rowStart;
+};
+}
+
+namespace fuzzy {
+uint64_t getCharMask(std::string_view str)
+{
+    uint64_t mask = 0;
+    for (const auto c : str)
+        mask |= charBits[static_cast<uint8_t>(c)];
+    return mask;
+}
+
+Matcher::Matcher(std::string_view query)
+    : query_(query)
+{
+    for (auto& c : query_)
+        c = toLower(c);
+    // See findAll
+    query_.erase(std::remove(query_.begin(), query_.end(), '\0'), query_.end());
+    charMask_ = getCharMask(query_);
+}
+
+const std::string& Matcher::getQuery() const
+{
+    return query_;
+}
+
+bool Matcher::mayMatch(uint64_t charMask) const
+{
+    return (charMask & charMask_) == charMask_;
+}
+
+// This is the DP of fzy, but only over the cells where the characters match, which are few. The
+// matches of every query character are found with SIMD and kept as a bitmap. For every query
+// character i we go through its possible matches in order and keep the best score of the matches
+// of i - 1 before it (minus the gap), which is M[i - 1][col - 1] in fzy.
+Score Matcher::score(std::string_view str, std::vector<size_t>* positions) const
+{
+    if (positions)
+        positions->clear();
+    const auto n = query_.size();
+    if (n == 0)
+        return 0;
+    if (str.empty())
+        return NoMatch;
+
+    thread_local Scratch scratchTls;
+    auto& scratch = scratchTls;
+    const auto numWords = (str.size() + 63) / 64;
+    scratch.bits.resize(n * numWords);
+    findAll(str, query_, scratch.bits.data(), numWords);
+    const auto getBits = [&](size_t i) { return scratch.bits.data() + i * numWords; };
+
+    // The earliest and the latest position every query character can be matched at. This is also
+    // where we find out whether it matches at all.
+    auto& first = scratch.first;
+    auto& last = scratch.last;
+    first.resize(n);
+    last.resize(n);
+    size_t pos = 0;
+    for (size_t i = 0; i < n; ++i) {
+        pos = nextBit(getBits(i), numWords, pos);
+        if (pos == npos)
+            return NoMatch;
+        first[i] = pos++;
+    }
+    pos = str.size() - 1;
+    for (size_t i = n; i-- > 0;) {
+        last[i] = prevBit(getBits(i), pos);
+        pos = last[i] - 1;
+    }
+
+    // The cells of row i are in [rowStart[i], rowStart[i + 1])
+    auto& cells = scratch.cells;
+    auto& rowStart = scratch.rowStart;
+    cells.clear();
+    rowStart.resize(n + 1);
+    for (size_t i = 0; i < n; ++i) {
+        rowStart[i] = cells.size();
+        size_t prev = i > 0 ? rowStart[i - 1] : 0;
+        // The best score of the previous row, as if it was at column 0
+        Score best = Impossible;
+        for (auto col = first[i]; col <= last[i]; col = nextBit(getBits(i), numWords, col + 1)) {
+            const auto bonus = getBonus(col > 0 ? str[col - 1] : '/', str[col]);
+            if (i == 0) {
+                cells.push_back(Cell { col, static_cast<Score>(col) * GapLeading + bonus });
+                continue;
+            }
+            for (; prev < rowStart[i] && cells[prev].col < col; ++prev) {
+                const auto& cell = cells[prev];
+                best = std::max(best, cell.score - static_cast<Score>(cell.col) * GapInner);
+            }
+            auto score = best + static_cast<Score>(col - 1) * GapInner + bonus;
+            if (cells[prev - 1].col == col - 1)
+                score = std::max(score, cells[prev - 1].score + MatchConsecutive);
+            cells.push_back(Cell { col, score });
+        }
+    }
+    rowStart[n] = cells.size();
+
+    Score result = NoMatch;
+    size_t cell = 0;
+    for (size_t c = rowStart[n - 1]; c < cells.size(); ++c) {
+        const auto score
+            = cells[c].score + static_cast<Score>(str.size() - 1 - cells[c].col) * GapTrailing;
+        if (score >= result) {
+            result = score;
+            cell = c;
+        }
+    }
+
+    if (positions) {
+        // Walk back and find the cells the scores came from. Consecutive matches win ties.
+        positions->resize(n);
+        for (size_t i = n; i-- > 0;) {
+            const auto [col, score] = cells[cell];
+            (*positions)[i] = col;
+            if (i == 0)
+                break;
+            const auto bonus = getBonus(col > 0 ? str[col - 1] : '/', str[col]);
+            for (size_t c = rowStart[i - 1]; c < rowStart[i] && cells[c].col < col; ++c) {
+                if (cells[c].col == col - 1 && cells[c].score + MatchConsecutive == score) {
+                    cell = c;
+                    break;
+                }
+                const auto gap = static_cast<Score>(col - 1 - cells[c].col) * GapInner;
+                if (cells[c].score + gap + bonus == score)
+                    cell = c;
+            }
+        }
+    }
+    return result;
+}
 }
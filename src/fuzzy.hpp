@@ -1,8 +1,39 @@
 #pragma once
 
+#include <cstdint>
+#include <limits>
 #include <string>
 #include <string_view>
 #include <vector>
 
-size_t fuzzyMatchScore(
-    std::string_view input, std::string_view str, std::vector<size_t>* matchedCharacters = nullptr);
+// Fuzzy matching for the prompt options, similar to fzy. The characters of the query have to appear
+// in the string in the same order (ignoring case). Of all the ways they can be matched, the best
+// one is found with dynamic programming: consecutive matches and matches at the start of a word
+// (after '/', '-', '_', ' ', '.' or at a camelCase hump) score high, gaps cost a little.
+namespace fuzzy {
+using Score = int32_t;
+constexpr Score NoMatch = std::numeric_limits<Score>::min();
+
+// Which characters are in str, ignoring case. Some characters share a bit, so this can only be
+// used to rule out matches. It's meant to be computed once per option.
+uint64_t getCharMask(std::string_view str);
+
+class Matcher {
+public:
+    Matcher(std::string_view query = "");
+
+    const std::string& getQuery() const;
+
+    // A cheap check that rejects most strings: charMask (from getCharMask(str)) has to contain all
+    // the characters of the query.
+    bool mayMatch(uint64_t charMask) const;
+
+    // Returns NoMatch if str does not match. Higher is better. If positions is not null, it is
+    // filled with the offsets of the matched characters. An empty query matches everything with 0.
+    Score score(std::string_view str, std::vector<size_t>* positions = nullptr) const;
+
+private:
+    std::string query_; // lower case
+    uint64_t charMask_ = 0;
+};
+}
@@ -0,0 +1,165 @@
+#include "gitignore.hpp"
+
+namespace {
+// glob starts with '['. Returns the length of the class (with the brackets) or 0 if it's not
+// closed, in which case the '[' is just a character. matched is set to whether ch is in the class.
+size_t matchClass(std::string_view glob, char ch, bool& matched)
+{
+    const auto uch = static_cast<unsigned char>(ch);
+    size_t i = 1;
+    bool negated = false;
+    if (i < glob.size() && (glob[i] == '!' || glob[i] == '^')) {
+        negated = true;
+        i++;
+    }
+
+    const auto getChar = [&]() {
+        if (glob[i] == '\\' && i + 1 < glob.size())
+            i++;
+        return static_cast<unsigned char>(glob[i++]);
+    };
+
+    bool found = false;
+    const auto start = i;
+    // A ']' right at the start is part of the class
+    while (i < glob.size() && (glob[i] != ']' || i == start)) {
+        const auto lo = getChar();
+        auto hi = lo;
+        if (i + 1 < glob.size() && glob[i] == '-' && glob[i + 1] != ']') {
+            i++;
+            hi = getChar();
+        }
+        if (lo <= uch && uch <= hi)
+            found = true;
+    }
+    if (i >= glob.size())
+        return 0;
+    matched = found != negated && ch != '/';
+    return i + 1;
+}
+}
+
+namespace gitignore {
+bool Pattern::matches(std::string_view path, std::string_view name, bool isDir) const
+{
+    if (dirOnly && !isDir)
+        return false;
+    return globMatch(glob, anchored ? path : name);
+}
+
+std::vector<Pattern> parse(std::string_view text)
+{
+    std::vector<Pattern> patterns;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        auto end = text.find('\n', pos);
+        if (end == std::string_view::npos)
+            end = text.size();
+        auto line = text.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        // Trailing spaces are ignored, unless they are escaped
+        while (!line.empty() && line.back() == ' '
+            && !(line.size() >= 2 && line[line.size() - 2] == '\\'))
+            line.remove_suffix(1);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        Pattern pattern;
+        if (line[0] == '!') {
+            pattern.negated = true;
+            line.remove_prefix(1);
+        }
+        if (!line.empty() && line.back() == '/') {
+            pattern.dirOnly = true;
+            line.remove_suffix(1);
+        }
+        if (line.empty())
+            continue;
+        if (line[0] == '/') {
+            pattern.anchored = true;
+            line.remove_prefix(1);
+        } else if (line.find('/') != std::string_view::npos) {
+            pattern.anchored = true;
+        }
+        pattern.glob = std::string(line);
+        patterns.push_back(std::move(pattern));
+    }
+    return patterns;
+}
+
+bool globMatch(std::string_view glob, std::string_view str)
+{
+    size_t g = 0;
+    size_t s = 0;
+    while (g < glob.size()) {
+        const auto c = glob[g];
+        if (c == '*') {
+            const auto doubleStar = g + 1 < glob.size() && glob[g + 1] == '*';
+            if (doubleStar && (g == 0 || glob[g - 1] == '/')) {
+                const auto rest = glob.substr(g + 2);
+                if (rest.empty()) // "**" at the end matches everything
+                    return true;
+                if (rest[0] == '/') { // "**/" matches zero or more directories
+                    const auto after = rest.substr(1);
+                    size_t i = s;
+                    while (true) {
+                        if (globMatch(after, str.substr(i)))
+                            return true;
+                        i = str.find('/', i);
+                        if (i == std::string_view::npos)
+                            return false;
+                        i++;
+                    }
+                }
+            }
+
+            // Anything else is like a single "*", which does not match a '/'
+            while (g < glob.size() && glob[g] == '*')
+                g++;
+            const auto rest = glob.substr(g);
+            for (size_t i = s; i <= str.size(); ++i) {
+                if (globMatch(rest, str.substr(i)))
+                    return true;
+                if (i < str.size() && str[i] == '/')
+                    return false;
+            }
+            return false;
+        }
+
+        if (s >= str.size())
+            return false;
+
+        if (c == '?') {
+            if (str[s] == '/')
+                return false;
+            g++;
+            s++;
+            continue;
+        }
+
+        if (c == '[') {
+            bool matched = false;
+            const auto len = matchClass(glob.substr(g), str[s], matched);
+            if (len > 0) {
+                if (!matched)
+                    return false;
+                g += len;
+                s++;
+                continue;
+            }
+        }
+
+        auto ch = c;
+        if (c == '\\' && g + 1 < glob.size())
+            ch = glob[++g];
+        if (str[s] != ch)
+            return false;
+        g++;
+        s++;
+    }
+    return s == str.size();
+}
+}
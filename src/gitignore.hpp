@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The patterns of .gitignore (and .ignore) files. See "man gitignore".
+// Supported: comments, "!" to negate, a trailing "/" for directories only, patterns with a "/"
+// at the start or in the middle are relative to the directory of the file, "*", "?", "[...]" and
+// "**" (at the start, end or between two slashes). Escapes with "\" are supported too.
+namespace gitignore {
+struct Pattern {
+    std::string glob;
+    bool negated = false;
+    bool dirOnly = false;
+    bool anchored = false; // matched against the whole path, otherwise just the name
+
+    // path is relative to the directory of the ignore file and name is the last part of it
+    bool matches(std::string_view path, std::string_view name, bool isDir) const;
+};
+
+std::vector<Pattern> parse(std::string_view text);
+
+// Like fnmatch with FNM_PATHNAME, but with "**"
+bool globMatch(std::string_view glob, std::string_view str);
+}
@@ -73,10 +73,41 @@ const std::string& Highlighter::getColor(size_t highlightId) const
     return highlights_.at(highlightId).color;
 }
 
-Highlighting::Highlighting(const Highlighter& highlighter)
+namespace {
+// This is a safety net for pathological input, so the worker doesn't keep spinning forever.
+// Until the text changes again, we will keep using the old tree.
+constexpr uint64_t parseTimeoutMicros = 5'000'000;
+}
+
+Highlighting::Highlighting(const Highlighter& highlighter, std::function<void()> onUpdate)
+    : Highlighting(highlighter, std::move(onUpdate),
+        getEventHandler().addCustomHandler([this] { finishParse(); }))
+{
+}
+
+Highlighting::Highlighting(const Highlighter& highlighter, std::function<void()> onUpdate,
+    std::pair<EventHandler::HandlerId, CustomEvent> parseFinishedHandler)
     : highlighter_(highlighter)
+    , onUpdate_(std::move(onUpdate))
+    , parseFinishedHandler_(getEventHandler(), parseFinishedHandler.first)
+    , parseFinishedEvent_(std::move(parseFinishedHandler.second))
 {
+    static_assert(sizeof(std::atomic<size_t>) == sizeof(size_t));
     parser_.setLanguage(highlighter_.getLanguage());
+    parser_.setTimeoutMicros(parseTimeoutMicros);
+    parser_.setCancellationFlag(reinterpret_cast<const size_t*>(&cancelFlag_));
+    worker_ = std::thread([this] { workerMain(); });
+}
+
+Highlighting::~Highlighting()
+{
+    {
+        std::lock_guard lock(mutex_);
+        quit_ = true;
+    }
+    cancelFlag_.store(1);
+    jobCondition_.notify_one();
+    worker_.join();
 }
 
 const Highlighter& Highlighting::getHighlighter() const
@@ -86,27 +117,153 @@ const Highlighter& Highlighting::getHighlighter() const
 
 void Highlighting::reset()
 {
-    parser_.reset();
+    if (parsing_) {
+        // The result would not match the text anymore, so don't bother finishing
+        cancelFlag_.store(1);
+        parsing_ = false;
+    }
+    generation_++;
     tree_.reset();
+    pendingEdits_.clear();
+    parsedVersionId_ = MaxSizeT;
 }
 
-void Highlighting::update(const TextBuffer& text)
+void Highlighting::edit(
+    const TextBuffer& text, size_t offset, size_t oldLength, std::string_view newText)
 {
-    auto tree = parser_.parse(
-        nullptr, // If we want to reuse the tree, we actually have to call edit
-        [&text](size_t index, TSPoint) {
-            const auto str = text.getString(index);
-            return std::make_pair(str.data(), str.size());
-        },
-        ts::InputEncoding::Utf8);
-    if (!tree)
-        die("Could not parse file");
-    tree_ = std::move(tree);
+    if (!tree_ && !parsing_)
+        return;
+
+    auto getPoint = [&text](size_t offset) {
+        const auto line = text.getLineIndex(offset);
+        const auto column = offset - text.getLine(line).offset;
+        return TSPoint { static_cast<uint32_t>(line), static_cast<uint32_t>(column) };
+    };
+    const auto start = getPoint(offset);
+    const auto oldEnd = getPoint(offset + oldLength);
+
+    const auto newlines = countNewlines(newText);
+    const auto newEnd = newlines == 0
+        ? TSPoint { start.row, static_cast<uint32_t>(start.column + newText.size()) }
+        : TSPoint { static_cast<uint32_t>(start.row + newlines),
+              static_cast<uint32_t>(newText.size() - newText.rfind('\n') - 1) };
+
+    const auto edit = TSInputEdit {
+        static_cast<uint32_t>(offset),
+        static_cast<uint32_t>(offset + oldLength),
+        static_cast<uint32_t>(offset + newText.size()),
+        start,
+        oldEnd,
+        newEnd,
+    };
+    if (tree_)
+        tree_->edit(edit);
+    // The tree we get from the worker will be for the text before this edit
+    if (parsing_)
+        pendingEdits_.push_back(edit);
+}
+
+void Highlighting::update(const TextBuffer& text, size_t versionId)
+{
+    // Most redraws are caused by cursor movement, resizes, etc. and don't change the text. If
+    // parsing this version timed out, we don't try again either.
+    if (versionId == parsedVersionId_)
+        return;
+
+    // If we are parsing already, we will be called again (via onUpdate) when it's done and
+    // parse the newest version then.
+    if (parsing_)
+        return;
+
+    {
+        std::lock_guard lock(mutex_);
+        // The old tree has been edited along with the text, so tree-sitter only needs to reparse
+        // the parts that changed.
+        job_ = Job { text, tree_ ? tree_->copy() : nullptr, versionId, generation_ };
+    }
+    parsing_ = true;
+    pendingEdits_.clear();
+    jobCondition_.notify_one();
+}
+
+void Highlighting::finishParse()
+{
+    std::optional<Result> result;
+    {
+        std::lock_guard lock(mutex_);
+        result = std::move(result_);
+        result_.reset();
+    }
+    if (!result || result->generation != generation_)
+        return;
+
+    parsing_ = false;
+    // If parsing timed out, we don't try again until the text changes
+    parsedVersionId_ = result->versionId;
+    if (!result->tree) {
+        debug("Parsing timed out");
+        // Nothing to redraw, unless the text changed in the meantime, so the newer version is
+        // parsed (see update)
+        const auto changed = !pendingEdits_.empty();
+        pendingEdits_.clear();
+        if (changed && onUpdate_)
+            onUpdate_();
+        return;
+    }
+    for (const auto& edit : pendingEdits_)
+        result->tree->edit(edit);
+    tree_ = std::move(result->tree);
+    pendingEdits_.clear();
+
+    if (onUpdate_)
+        onUpdate_();
+}
+
+void Highlighting::workerMain()
+{
+    while (true) {
+        std::optional<Job> job;
+        {
+            std::unique_lock lock(mutex_);
+            jobCondition_.wait(lock, [this] { return quit_ || job_; });
+            if (quit_)
+                return;
+            job = std::move(job_);
+            job_.reset();
+            cancelFlag_.store(0);
+        }
+
+        const auto& text = job->text;
+        auto tree = parser_.parse(
+            job->oldTree.get(),
+            [&text](size_t index, TSPoint) {
+                const auto str = text.getString(index);
+                return std::make_pair(str.data(), str.size());
+            },
+            ts::InputEncoding::Utf8);
+
+        if (cancelFlag_.load()) {
+            // Otherwise the parser would try to resume the cancelled parse next time
+            parser_.reset();
+            continue;
+        }
+        if (!tree)
+            parser_.reset();
+
+        {
+            std::lock_guard lock(mutex_);
+            result_ = Result { std::move(tree), job->versionId, job->generation };
+        }
+        parseFinishedEvent_.emit();
+    }
 }
 
 std::vector<Highlight> Highlighting::getHighlights(size_t start, size_t end) const
 {
-    assert(tree_);
+    // The first parse has not finished yet
+    if (!tree_)
+        return {};
+
     ts::QueryCursor cursor;
     cursor.setByteRange(start, end);
     cursor.exec(highlighter_.query, tree_->getRootNode());
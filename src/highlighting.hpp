@@ -1,8 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+
 #include "tree-sitter.hpp"
 
 #include "colorscheme.hpp"
+#include "eventhandler.hpp"
 #include "textbuffer.hpp"
 
 class Highlighter {
@@ -39,17 +47,29 @@ struct Highlight {
     size_t end;
 };
 
+// Parsing happens on a worker thread on a snapshot of the text. Until the new tree is available,
+// the last tree (edited to match the current text) is used for highlighting.
 class Highlighting {
 public:
-    Highlighting(const Highlighter& highlighter);
+    // onUpdate will be called on the main thread when a new tree is available
+    Highlighting(const Highlighter& highlighter, std::function<void()> onUpdate = nullptr);
+    ~Highlighting();
+
+    Highlighting(const Highlighting&) = delete;
+    Highlighting& operator=(const Highlighting&) = delete;
 
     const Highlighter& getHighlighter() const;
 
-    // edit
+    // This has to be called *before* the text is modified, so the old tree can be reused when
+    // parsing the next time.
+    void edit(const TextBuffer& text, size_t offset, size_t oldLength, std::string_view newText);
 
     void reset();
 
-    void update(const TextBuffer& text);
+    // versionId identifies the state of the text (e.g. ActionStack::getCurrentVersionId), so
+    // we can skip parsing if nothing changed since the last update.
+    // This only starts parsing in the background and returns immediately.
+    void update(const TextBuffer& text, size_t versionId);
 
     // This will return a vector of highlights with highlight[i].start <= highlights[i+1].start
     std::vector<Highlight> getHighlights(size_t start, size_t end) const;
@@ -59,7 +79,45 @@ public:
     const ts::Tree* getTree() const;
 
 private:
+    struct Job {
+        TextBuffer text; // copying a TextBuffer is cheap
+        std::unique_ptr<ts::Tree> oldTree;
+        size_t versionId;
+        size_t generation;
+    };
+
+    struct Result {
+        std::unique_ptr<ts::Tree> tree; // nullptr if parsing timed out
+        size_t versionId;
+        size_t generation;
+    };
+
+    Highlighting(const Highlighter& highlighter, std::function<void()> onUpdate,
+        std::pair<EventHandler::HandlerId, CustomEvent> parseFinishedHandler);
+
+    void finishParse();
+    void workerMain();
+
     const Highlighter& highlighter_;
-    ts::Parser parser_;
+    std::function<void()> onUpdate_;
     std::unique_ptr<ts::Tree> tree_;
+    size_t parsedVersionId_ = MaxSizeT;
+    // The edits that were made after the snapshot of the current job was taken
+    std::vector<TSInputEdit> pendingEdits_;
+    bool parsing_ = false;
+    // This is incremented by reset, so results from parses started before are discarded
+    size_t generation_ = 0;
+    ScopedHandlerHandle parseFinishedHandler_;
+    CustomEvent parseFinishedEvent_;
+
+    // Only used by the worker thread
+    ts::Parser parser_;
+
+    std::mutex mutex_;
+    std::condition_variable jobCondition_;
+    std::optional<Job> job_;
+    std::optional<Result> result_;
+    bool quit_ = false;
+    std::atomic<size_t> cancelFlag_ { 0 };
+    std::thread worker_; // last, so everything is initialized when the thread starts
 };
@@ -34,6 +34,8 @@ std::string toString(SpecialKey key)
         return "Right";
     case SpecialKey::Left:
         return "Left";
+    case SpecialKey::Paste:
+        return "Paste";
     default:
         return "Unknown";
     }
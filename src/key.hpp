@@ -20,6 +20,7 @@ enum class SpecialKey {
     Down,
     Right,
     Left,
+    Paste, // The pasted text is in Key::bytes
 };
 
 std::string toString(SpecialKey key);
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cctype>
 #include <cstdio>
@@ -59,6 +60,10 @@ bool processBufferInput(Buffer& buffer, const Key& key)
             else
                 buffer.indent();
             return true;
+        case SpecialKey::Paste:
+            // A single insert, so it's a single undo step and there is no auto-indent
+            buffer.insert(std::string_view(key.bytes.data(), key.bytes.size()));
+            return true;
         default:
             return false;
         }
@@ -113,6 +118,17 @@ void processPromptInput(const Key& key)
 {
     auto prompt = editor::getPrompt();
     const auto text = prompt->input.getText().getString();
+
+    // The prompt input is a single line, so only paste the first line
+    const auto special = std::get_if<SpecialKey>(&key.key);
+    if (special && *special == SpecialKey::Paste) {
+        const auto nl = std::find(key.bytes.begin(), key.bytes.end(), '\n');
+        if (nl != key.bytes.end()) {
+            processPromptInput(Key(std::vector<char>(key.bytes.begin(), nl), SpecialKey::Paste));
+            return;
+        }
+    }
+
     if (processBufferInput(prompt->input, key)) {
         // not very clever of checking whether the input changed something
         if (text != prompt->input.getText().getString())
@@ -211,15 +227,21 @@ int main(int argc, char** argv)
 
     getEventHandler().addFdHandler(STDIN_FILENO, [] {
         debug("read stdin");
-        const auto key = terminal::readKey();
-        if (key) {
-            // debugKey(*key);
-            if (editor::getPrompt())
-                processPromptInput(*key);
-            else
-                processInput(editor::getBuffer(), *key);
-            editor::triggerRedraw();
+        // Process every key we got at once (e.g. key repeat or pasting), but only redraw once.
+        // We have to read until there is nothing left (see addFdHandler).
+        bool anyKeys = false;
+        while (terminal::readInput() > 0) {
+            while (const auto key = terminal::readKey()) {
+                // debugKey(*key);
+                if (editor::getPrompt())
+                    processPromptInput(*key);
+                else
+                    processInput(editor::getBuffer(), *key);
+                anyKeys = true;
+            }
         }
+        if (anyKeys)
+            editor::triggerRedraw();
     });
 
     getEventHandler().run();
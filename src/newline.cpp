@@ -0,0 +1,148 @@
+#include "newline.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EXQUISITE_NEWLINE_X86
+#include <immintrin.h>
+#endif
+
+namespace newline {
+namespace {
+    size_t countScalar(const char* data, size_t size)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < size; ++i)
+            count += data[i] == '\n';
+        return count;
+    }
+
+    size_t findScalar(const char* data, size_t size, size_t n)
+    {
+        for (size_t i = 0; i < size; ++i) {
+            if (data[i] == '\n') {
+                if (n == 0)
+                    return i;
+                n--;
+            }
+        }
+        return size;
+    }
+
+#ifdef EXQUISITE_NEWLINE_X86
+    // Returns the index of the n-th set bit. mask must have more than n bits set.
+    size_t nthSetBit(uint32_t mask, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            mask &= mask - 1; // clear lowest set bit
+        return __builtin_ctz(mask);
+    }
+
+    // The comparison results are 0xff (= -1) per matching byte, so subtracting them counts up by
+    // one per newline in each byte lane. Before a lane can overflow (255 iterations), the lanes are
+    // summed with psadbw.
+    size_t countSse2(const char* data, size_t size)
+    {
+        const auto nl = _mm_set1_epi8('\n');
+        size_t count = 0;
+        size_t i = 0;
+        while (i + 16 <= size) {
+            auto acc = _mm_setzero_si128();
+            for (size_t n = 0; n < 255 && i + 16 <= size; ++n, i += 16) {
+                const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+            }
+            const auto sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+            count += static_cast<size_t>(_mm_cvtsi128_si32(sums))
+                + static_cast<size_t>(_mm_extract_epi16(sums, 4));
+        }
+        return count + countScalar(data + i, size - i);
+    }
+
+    size_t findSse2(const char* data, size_t size, size_t n)
+    {
+        const auto nl = _mm_set1_epi8('\n');
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+            if (mask == 0)
+                continue;
+            const auto num = static_cast<size_t>(__builtin_popcount(mask));
+            if (n < num)
+                return i + nthSetBit(mask, n);
+            n -= num;
+        }
+        return i + findScalar(data + i, size - i, n);
+    }
+
+    __attribute__((target("avx2"))) size_t countAvx2(const char* data, size_t size)
+    {
+        const auto nl = _mm256_set1_epi8('\n');
+        size_t count = 0;
+        size_t i = 0;
+        while (i + 32 <= size) {
+            auto acc = _mm256_setzero_si256();
+            for (size_t n = 0; n < 255 && i + 32 <= size; ++n, i += 32) {
+                const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+            }
+            const auto sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+            count += static_cast<size_t>(_mm256_extract_epi64(sums, 0))
+                + static_cast<size_t>(_mm256_extract_epi64(sums, 1))
+                + static_cast<size_t>(_mm256_extract_epi64(sums, 2))
+                + static_cast<size_t>(_mm256_extract_epi64(sums, 3));
+        }
+        return count + countSse2(data + i, size - i);
+    }
+
+    __attribute__((target("avx2,popcnt"))) size_t findAvx2(const char* data, size_t size, size_t n)
+    {
+        const auto nl = _mm256_set1_epi8('\n');
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+            if (mask == 0)
+                continue;
+            const auto num = static_cast<size_t>(__builtin_popcount(mask));
+            if (n < num)
+                return i + nthSetBit(mask, n);
+            n -= num;
+        }
+        return i + findSse2(data + i, size - i, n);
+    }
+#endif
+}
+
+const std::vector<Kernel>& getKernels()
+{
+    static const std::vector<Kernel> kernels = [] {
+        std::vector<Kernel> kernels { Kernel { "scalar", countScalar, findScalar } };
+#ifdef EXQUISITE_NEWLINE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2"))
+            kernels.push_back(Kernel { "sse2", countSse2, findSse2 });
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+            kernels.push_back(Kernel { "avx2", countAvx2, findAvx2 });
+#endif
+        return kernels;
+    }();
+    return kernels;
+}
+
+const Kernel& getKernel()
+{
+    static const Kernel& kernel = getKernels().back();
+    return kernel;
+}
+
+size_t count(std::string_view str)
+{
+    return getKernel().count(str.data(), str.size());
+}
+
+size_t find(std::string_view str, size_t n)
+{
+    const auto idx = getKernel().find(str.data(), str.size(), n);
+    return idx < str.size() ? idx : std::string_view::npos;
+}
+}
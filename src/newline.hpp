@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+// Finding newlines is the hottest loop when loading big files, so this is vectorized.
+// The best implementation supported by the CPU is selected when it's first used.
+namespace newline {
+struct Kernel {
+    std::string_view name;
+    size_t (*count)(const char* data, size_t size);
+    // Returns the offset of the n-th (starting at 0) newline or size if there are not enough
+    size_t (*find)(const char* data, size_t size, size_t n);
+};
+
+// Only the kernels that the CPU supports. The first one is the scalar fallback.
+const std::vector<Kernel>& getKernels();
+const Kernel& getKernel();
+
+size_t count(std::string_view str);
+// Returns std::string_view::npos if there are not enough newlines
+size_t find(std::string_view str, size_t n = 0);
+}
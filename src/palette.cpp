@@ -12,6 +12,10 @@ std::vector<PaletteEntry>& getPalette()
         { "Undo", commands::undo() },
         { "Redo", commands::redo() },
         { "Goto File", commands::gotoFile() },
+        { "Find Regex", commands::findRegex() },
+        { "Find in Files", commands::findInFiles() },
+        { "Replace All", commands::replaceAll() },
+        { "Replace All Regex", commands::replaceAllRegex() },
         { "Copy", commands::copy() },
         { "Paste", commands::paste() },
         { "Set Language", commands::setLanguage() },
@@ -23,6 +27,7 @@ std::vector<PaletteEntry>& getPalette()
         { "Indent Using Spaces", commands::indentUsingSpaces() },
         { "Indent Using Tagbs", commands::indentUsingTabs() },
         { "Set Tab Width", commands::setTabWidth() },
+        { "Show Frame Statistics", commands::showFrameStats() },
     };
     std::sort(palette.begin(), palette.end(),
         [](const PaletteEntry& a, const PaletteEntry& b) { return a.title < b.title; });
@@ -0,0 +1,1232 @@
+#include "regex.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#include "search.hpp"
+#include "utf8.hpp"
+
+namespace regex {
+namespace {
+constexpr auto npos = std::string_view::npos;
+constexpr size_t Unbounded = std::numeric_limits<size_t>::max();
+constexpr uint32_t MaxCodePoint = 0x10ffff;
+// Counted repetitions are expanded, so these keep "(a{1000}){1000}" from eating all the memory
+constexpr size_t MaxRepeat = 1000;
+constexpr size_t MaxProgramSize = 100'000;
+// If the DFA gets bigger than this, we throw it away and start over. Every state is a list of NFA
+// states and a row in the transition table, so this is a couple of MB at most.
+constexpr size_t MaxDfaStates = 10'000;
+
+using CodePointRanges = std::vector<std::pair<uint32_t, uint32_t>>; // inclusive
+
+enum class Assertion : uint8_t {
+    // These are relative to the direction we run in. "^" is PrevNewline in the forward program and
+    // NextNewline in the reverse one. The start and the end of the text count as newlines.
+    PrevNewline,
+    NextNewline,
+    WordBoundary,
+    NotWordBoundary,
+};
+
+struct Node {
+    enum class Type { Empty, Literal, Class, Concat, Alternate, Repeat, Assert };
+
+    Type type = Type::Empty;
+    std::string literal; // utf8
+    CodePointRanges ranges; // sorted and not overlapping
+    std::vector<Node> children;
+    size_t min = 0;
+    size_t max = 0;
+    bool greedy = true;
+    Assertion assertion = Assertion::PrevNewline;
+};
+
+Node makeNode(Node::Type type)
+{
+    Node node;
+    node.type = type;
+    return node;
+}
+
+std::string encode(uint32_t cp)
+{
+    std::string str;
+    if (cp < 0x80) {
+        str.push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+        str.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+        str.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    } else if (cp < 0x10000) {
+        str.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+        str.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+        str.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    } else {
+        str.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+        str.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+        str.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+        str.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    }
+    return str;
+}
+
+// Invalid bytes are returned as they are
+uint32_t decode(std::string_view str, size_t& pos)
+{
+    const auto first = static_cast<uint8_t>(str[pos]);
+    const auto len = utf8::getCodePointLength(str[pos]);
+    if (len == 1 || pos + len > str.size()) {
+        pos++;
+        return first;
+    }
+    static constexpr std::array<uint8_t, 5> firstMask { 0, 0x7f, 0x1f, 0x0f, 0x07 };
+    uint32_t cp = first & firstMask[len];
+    for (size_t i = 1; i < len; ++i) {
+        if (!utf8::isContinuationByte(str[pos + i])) {
+            pos++;
+            return first;
+        }
+        cp = (cp << 6) | (static_cast<uint8_t>(str[pos + i]) & 0x3f);
+    }
+    pos += len;
+    return cp;
+}
+
+void normalize(CodePointRanges& ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+    CodePointRanges merged;
+    for (const auto& range : ranges) {
+        if (!merged.empty() && range.first <= merged.back().second + 1)
+            merged.back().second = std::max(merged.back().second, range.second);
+        else
+            merged.push_back(range);
+    }
+    ranges = std::move(merged);
+}
+
+CodePointRanges negate(const CodePointRanges& ranges)
+{
+    CodePointRanges negated;
+    uint32_t next = 0;
+    for (const auto& [lo, hi] : ranges) {
+        if (lo > next)
+            negated.emplace_back(next, lo - 1);
+        next = hi + 1;
+    }
+    if (next <= MaxCodePoint)
+        negated.emplace_back(next, MaxCodePoint);
+    return negated;
+}
+
+bool isWordByte(uint8_t ch)
+{
+    return (ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z')
+        || ch == '_';
+}
+
+class Parser {
+public:
+    Parser(std::string_view pattern)
+        : pattern_(pattern)
+    {
+    }
+
+    std::optional<Node> parse()
+    {
+        auto node = parseAlternate();
+        if (error_.empty() && pos_ < pattern_.size())
+            error_ = "Unmatched )";
+        if (!error_.empty())
+            return std::nullopt;
+        return node;
+    }
+
+    const std::string& getError() const
+    {
+        return error_;
+    }
+
+private:
+    bool ok() const
+    {
+        return error_.empty() && pos_ < pattern_.size();
+    }
+
+    bool at(char ch) const
+    {
+        return pos_ < pattern_.size() && pattern_[pos_] == ch;
+    }
+
+    bool accept(char ch)
+    {
+        if (!at(ch))
+            return false;
+        pos_++;
+        return true;
+    }
+
+    void fail(std::string message)
+    {
+        if (error_.empty())
+            error_ = std::move(message);
+        pos_ = pattern_.size();
+    }
+
+    Node parseAlternate()
+    {
+        auto node = parseConcat();
+        if (!at('|'))
+            return node;
+        auto alt = makeNode(Node::Type::Alternate);
+        alt.children.push_back(std::move(node));
+        while (accept('|'))
+            alt.children.push_back(parseConcat());
+        return alt;
+    }
+
+    Node parseConcat()
+    {
+        auto concat = makeNode(Node::Type::Concat);
+        while (ok() && !at('|') && !at(')')) {
+            auto atom = parseAtom();
+            concat.children.push_back(parseRepeat(std::move(atom)));
+        }
+        if (concat.children.size() == 1)
+            return std::move(concat.children[0]);
+        if (concat.children.empty())
+            return makeNode(Node::Type::Empty);
+        return concat;
+    }
+
+    // "{" that does not start a valid count is just a literal (like in most engines)
+    bool parseCount(size_t& min, size_t& max)
+    {
+        const auto start = pos_;
+        const auto number = [this](size_t& n) {
+            const auto first = pos_;
+            n = 0;
+            while (pos_ < pattern_.size() && pattern_[pos_] >= '0' && pattern_[pos_] <= '9') {
+                n = std::min(n * 10 + (pattern_[pos_] - '0'), MaxRepeat + 1);
+                pos_++;
+            }
+            return pos_ > first;
+        };
+        if (accept('{') && number(min)) {
+            max = min;
+            if (accept(',') && !number(max))
+                max = Unbounded;
+            if (accept('}'))
+                return true;
+        }
+        pos_ = start;
+        return false;
+    }
+
+    Node parseRepeat(Node atom)
+    {
+        while (ok()) {
+            size_t min = 0, max = 0;
+            if (accept('*')) {
+                max = Unbounded;
+            } else if (accept('+')) {
+                min = 1;
+                max = Unbounded;
+            } else if (accept('?')) {
+                max = 1;
+            } else if (!parseCount(min, max)) {
+                break;
+            }
+
+            if (min > MaxRepeat || (max != Unbounded && max > MaxRepeat)) {
+                fail("Repetition count is too large");
+                break;
+            }
+            if (max < min) {
+                fail("Invalid repetition count");
+                break;
+            }
+            auto repeat = makeNode(Node::Type::Repeat);
+            repeat.min = min;
+            repeat.max = max;
+            repeat.greedy = !accept('?');
+            repeat.children.push_back(std::move(atom));
+            atom = std::move(repeat);
+        }
+        return atom;
+    }
+
+    Node parseAtom()
+    {
+        const auto ch = pattern_[pos_];
+        if (accept('(')) {
+            if (accept('?') && !accept(':')) {
+                fail("Unsupported group");
+                return Node {};
+            }
+            auto node = parseAlternate();
+            if (!accept(')'))
+                fail("Missing )");
+            return node;
+        } else if (ch == '*' || ch == '+' || ch == '?') {
+            fail("Nothing to repeat");
+            return Node {};
+        } else if (accept('.')) {
+            auto node = makeNode(Node::Type::Class);
+            node.ranges = negate({ { '\n', '\n' } });
+            return node;
+        } else if (accept('[')) {
+            return parseClass();
+        } else if (accept('^')) {
+            return makeAssert(Assertion::PrevNewline);
+        } else if (accept('$')) {
+            return makeAssert(Assertion::NextNewline);
+        } else if (accept('\\')) {
+            if (accept('b'))
+                return makeAssert(Assertion::WordBoundary);
+            if (accept('B'))
+                return makeAssert(Assertion::NotWordBoundary);
+            auto node = makeNode(Node::Type::Class);
+            uint32_t cp = 0;
+            if (parseEscape(node.ranges, cp))
+                return node;
+            node.type = Node::Type::Literal;
+            node.literal = encode(cp);
+            return node;
+        }
+
+        // Keep the bytes as they are, in case they are not valid utf8
+        auto node = makeNode(Node::Type::Literal);
+        const auto start = pos_;
+        decode(pattern_, pos_);
+        node.literal = std::string(pattern_.substr(start, pos_ - start));
+        return node;
+    }
+
+    Node makeAssert(Assertion assertion)
+    {
+        auto node = makeNode(Node::Type::Assert);
+        node.assertion = assertion;
+        return node;
+    }
+
+    // Returns true if it was a class escape (like "\d"), which is added to ranges. Otherwise the
+    // code point is returned in cp. The backslash is already consumed.
+    bool parseEscape(CodePointRanges& ranges, uint32_t& cp)
+    {
+        if (pos_ >= pattern_.size()) {
+            fail("Trailing \\");
+            return false;
+        }
+
+        static const CodePointRanges digit { { '0', '9' } };
+        static const CodePointRanges word {
+            { '0', '9' },
+            { 'A', 'Z' },
+            { '_', '_' },
+            { 'a', 'z' },
+        };
+        static const CodePointRanges space { { '\t', '\r' }, { ' ', ' ' } };
+        const auto addRanges = [&ranges](const CodePointRanges& add) {
+            ranges.insert(ranges.end(), add.begin(), add.end());
+            return true;
+        };
+
+        const auto ch = pattern_[pos_++];
+        switch (ch) {
+        case 'd':
+            return addRanges(digit);
+        case 'D':
+            return addRanges(negate(digit));
+        case 'w':
+            return addRanges(word);
+        case 'W':
+            return addRanges(negate(word));
+        case 's':
+            return addRanges(space);
+        case 'S':
+            return addRanges(negate(space));
+        case 'n':
+            cp = '\n';
+            return false;
+        case 't':
+            cp = '\t';
+            return false;
+        case 'r':
+            cp = '\r';
+            return false;
+        case 'f':
+            cp = '\f';
+            return false;
+        case 'v':
+            cp = '\v';
+            return false;
+        case '0':
+            cp = 0;
+            return false;
+        case 'x': {
+            const auto hex = [](char c) -> int {
+                if (c >= '0' && c <= '9')
+                    return c - '0';
+                if (c >= 'a' && c <= 'f')
+                    return c - 'a' + 10;
+                if (c >= 'A' && c <= 'F')
+                    return c - 'A' + 10;
+                return -1;
+            };
+            if (pos_ + 2 > pattern_.size() || hex(pattern_[pos_]) < 0
+                || hex(pattern_[pos_ + 1]) < 0) {
+                fail("Invalid \\x escape");
+                return false;
+            }
+            cp = static_cast<uint32_t>(hex(pattern_[pos_]) * 16 + hex(pattern_[pos_ + 1]));
+            pos_ += 2;
+            return false;
+        }
+        default:
+            // Escaping letters or digits that have no meaning is probably a mistake
+            if (isWordByte(static_cast<uint8_t>(ch))) {
+                fail(std::string("Unknown escape \\") + ch);
+                return false;
+            }
+            pos_--;
+            cp = decode(pattern_, pos_);
+            return false;
+        }
+    }
+
+    Node parseClass()
+    {
+        auto node = makeNode(Node::Type::Class);
+        const auto negated = accept('^');
+        // "]" right at the start is a literal
+        bool first = true;
+        while (true) {
+            if (pos_ >= pattern_.size()) {
+                fail("Missing ]");
+                return node;
+            }
+            if (!first && accept(']'))
+                break;
+            first = false;
+
+            uint32_t lo = 0;
+            if (accept('\\')) {
+                if (parseEscape(node.ranges, lo))
+                    continue;
+            } else {
+                lo = decode(pattern_, pos_);
+            }
+            if (!error_.empty())
+                return node;
+
+            uint32_t hi = lo;
+            if (pos_ + 1 < pattern_.size() && pattern_[pos_] == '-' && pattern_[pos_ + 1] != ']') {
+                pos_++;
+                if (accept('\\')) {
+                    CodePointRanges escapeRanges;
+                    if (parseEscape(escapeRanges, hi)) {
+                        fail("Invalid class range");
+                        return node;
+                    }
+                } else {
+                    hi = decode(pattern_, pos_);
+                }
+                if (hi < lo) {
+                    fail("Invalid class range");
+                    return node;
+                }
+            }
+            node.ranges.emplace_back(lo, hi);
+        }
+        normalize(node.ranges);
+        if (negated)
+            node.ranges = negate(node.ranges);
+        return node;
+    }
+
+    std::string_view pattern_;
+    size_t pos_ = 0;
+    std::string error_;
+};
+
+// Returns whether every match of node is exactly the same text and appends it to literal
+bool getLiteral(const Node& node, std::string& literal)
+{
+    switch (node.type) {
+    case Node::Type::Empty:
+    case Node::Type::Assert:
+        return true;
+    case Node::Type::Literal:
+        literal += node.literal;
+        return true;
+    case Node::Type::Class:
+        if (node.ranges.size() != 1 || node.ranges[0].first != node.ranges[0].second)
+            return false;
+        literal += encode(node.ranges[0].first);
+        return true;
+    case Node::Type::Concat:
+        for (const auto& child : node.children) {
+            if (!getLiteral(child, literal))
+                return false;
+        }
+        return true;
+    case Node::Type::Repeat: {
+        std::string str;
+        if (node.min != node.max || !getLiteral(node.children[0], str))
+            return false;
+        for (size_t i = 0; i < node.min; ++i)
+            literal += str;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Every match starts with this
+std::string getPrefix(const Node& node)
+{
+    std::string prefix;
+    if (getLiteral(node, prefix))
+        return prefix;
+    prefix.clear();
+
+    if (node.type == Node::Type::Concat) {
+        for (const auto& child : node.children) {
+            std::string literal;
+            if (!getLiteral(child, literal))
+                return prefix + getPrefix(child);
+            prefix += literal;
+        }
+    } else if (node.type == Node::Type::Repeat && node.min > 0) {
+        return getPrefix(node.children[0]);
+    } else if (node.type == Node::Type::Alternate) {
+        prefix = getPrefix(node.children[0]);
+        for (size_t i = 1; i < node.children.size() && !prefix.empty(); ++i) {
+            const auto other = getPrefix(node.children[i]);
+            const auto len = std::min(prefix.size(), other.size());
+            const auto diff = std::mismatch(prefix.begin(), prefix.begin() + len, other.begin());
+            prefix.resize(diff.first - prefix.begin());
+        }
+        // We might have cut a code point in half, but that doesn't matter for searching
+    }
+    return prefix;
+}
+
+// Every match contains this. It's the longest one we can find easily.
+std::string getRequired(const Node& node)
+{
+    std::string required;
+    if (getLiteral(node, required))
+        return required;
+    required.clear();
+
+    if (node.type == Node::Type::Concat) {
+        std::string run;
+        for (const auto& child : node.children) {
+            std::string literal;
+            if (getLiteral(child, literal)) {
+                run += literal;
+                continue;
+            }
+            if (run.size() > required.size())
+                required = run;
+            run.clear();
+            auto childRequired = getRequired(child);
+            if (childRequired.size() > required.size())
+                required = std::move(childRequired);
+        }
+        if (run.size() > required.size())
+            required = run;
+    } else if (node.type == Node::Type::Repeat && node.min > 0) {
+        return getRequired(node.children[0]);
+    }
+    return required;
+}
+
+struct Inst {
+    enum class Op : uint8_t { ByteRange, Split, Match, Assert };
+
+    Op op = Op::Match;
+    uint8_t lo = 0;
+    uint8_t hi = 0;
+    Assertion assertion = Assertion::PrevNewline;
+    uint32_t out = 0; // for Split this is the preferred one
+    uint32_t out1 = 0;
+};
+
+using Program = std::vector<Inst>;
+
+// The (byte) sequences of utf8 for all code points in [lo, hi]. Every sequence is a list of byte
+// ranges. This is the algorithm from Russ Cox' utf8 package in Go.
+void getUtf8Sequences(
+    uint32_t lo, uint32_t hi, std::vector<std::vector<std::pair<uint8_t, uint8_t>>>& sequences)
+{
+    // Split the range, so both ends have the same length in utf8
+    for (const uint32_t maxOfLength : { 0x7fu, 0x7ffu, 0xffffu }) {
+        if (lo <= maxOfLength && hi > maxOfLength) {
+            getUtf8Sequences(lo, maxOfLength, sequences);
+            getUtf8Sequences(maxOfLength + 1, hi, sequences);
+            return;
+        }
+    }
+
+    // And then so every byte but the first of lo and hi are either all the same or cover the
+    // whole range of continuation bytes
+    for (int i = 1; i < 4; ++i) {
+        const uint32_t mask = (1u << (6 * i)) - 1;
+        if ((lo & ~mask) == (hi & ~mask))
+            continue;
+        if ((lo & mask) != 0) {
+            getUtf8Sequences(lo, lo | mask, sequences);
+            getUtf8Sequences((lo | mask) + 1, hi, sequences);
+            return;
+        }
+        if ((hi & mask) != mask) {
+            getUtf8Sequences(lo, (hi & ~mask) - 1, sequences);
+            getUtf8Sequences(hi & ~mask, hi, sequences);
+            return;
+        }
+    }
+
+    const auto loBytes = encode(lo);
+    const auto hiBytes = encode(hi);
+    assert(loBytes.size() == hiBytes.size());
+    auto& seq = sequences.emplace_back();
+    for (size_t i = 0; i < loBytes.size(); ++i)
+        seq.emplace_back(static_cast<uint8_t>(loBytes[i]), static_cast<uint8_t>(hiBytes[i]));
+}
+
+// The program is compiled backwards, i.e. every node is compiled with the instruction that comes
+// after it, so we never have to patch up jumps (except for loops).
+// The reverse program matches the reversed text and is used to find where a match starts.
+class Compiler {
+public:
+    Compiler(bool reverse)
+        : reverse_(reverse)
+    {
+        program_.push_back(Inst { Inst::Op::Match }); // 0
+    }
+
+    // Returns the first instruction
+    uint32_t compile(const Node& node, uint32_t next)
+    {
+        if (tooLarge())
+            return next;
+
+        switch (node.type) {
+        case Node::Type::Empty:
+            return next;
+        case Node::Type::Literal:
+            return compileBytes(node.literal, next);
+        case Node::Type::Class:
+            return compileClass(node.ranges, next);
+        case Node::Type::Concat:
+            if (reverse_) {
+                for (const auto& child : node.children)
+                    next = compile(child, next);
+            } else {
+                for (auto it = node.children.rbegin(); it != node.children.rend(); ++it)
+                    next = compile(*it, next);
+            }
+            return next;
+        case Node::Type::Alternate: {
+            std::vector<uint32_t> alternatives;
+            for (const auto& child : node.children)
+                alternatives.push_back(compile(child, next));
+            return addSplits(alternatives);
+        }
+        case Node::Type::Repeat:
+            return compileRepeat(node, next);
+        case Node::Type::Assert: {
+            auto assertion = node.assertion;
+            if (reverse_ && assertion == Assertion::PrevNewline)
+                assertion = Assertion::NextNewline;
+            else if (reverse_ && assertion == Assertion::NextNewline)
+                assertion = Assertion::PrevNewline;
+            Inst inst { Inst::Op::Assert };
+            inst.assertion = assertion;
+            inst.out = next;
+            return add(inst);
+        }
+        }
+        return next;
+    }
+
+    uint32_t addSplit(uint32_t out, uint32_t out1)
+    {
+        Inst inst { Inst::Op::Split };
+        inst.out = out;
+        inst.out1 = out1;
+        return add(inst);
+    }
+
+    uint32_t addByteRange(uint8_t lo, uint8_t hi, uint32_t out)
+    {
+        Inst inst { Inst::Op::ByteRange };
+        inst.lo = lo;
+        inst.hi = hi;
+        inst.out = out;
+        return add(inst);
+    }
+
+    // A copy of what can be reached from first without consuming a byte, but where the match is a
+    // dead end. The byte ranges lead back to the original instructions, so starting here only
+    // matches after at least one byte.
+    uint32_t compileNonEmpty(uint32_t first)
+    {
+        std::unordered_map<uint32_t, uint32_t> copies;
+        std::vector<uint32_t> stack { first };
+        while (!stack.empty()) {
+            const auto i = stack.back();
+            stack.pop_back();
+            if (copies.count(i))
+                continue;
+            const auto inst = program_[i]; // add might reallocate
+            copies.emplace(i, add(inst));
+            if (inst.op == Inst::Op::Split || inst.op == Inst::Op::Assert)
+                stack.push_back(inst.out);
+            if (inst.op == Inst::Op::Split)
+                stack.push_back(inst.out1);
+        }
+        for (const auto [orig, copy] : copies) {
+            auto& inst = program_[copy];
+            if (inst.op == Inst::Op::Match) {
+                inst = Inst { Inst::Op::ByteRange };
+                inst.lo = 1; // matches nothing
+            } else if (inst.op != Inst::Op::ByteRange) {
+                inst.out = copies.at(inst.out);
+                if (inst.op == Inst::Op::Split)
+                    inst.out1 = copies.at(inst.out1);
+            }
+        }
+        return copies.at(first);
+    }
+
+    bool tooLarge() const
+    {
+        return program_.size() > MaxProgramSize;
+    }
+
+    Program& getProgram()
+    {
+        return program_;
+    }
+
+private:
+    uint32_t add(const Inst& inst)
+    {
+        program_.push_back(inst);
+        return static_cast<uint32_t>(program_.size() - 1);
+    }
+
+    // The first one is preferred
+    uint32_t addSplits(const std::vector<uint32_t>& alternatives)
+    {
+        auto first = alternatives.back();
+        for (size_t i = alternatives.size() - 1; i-- > 0;)
+            first = addSplit(alternatives[i], first);
+        return first;
+    }
+
+    uint32_t compileBytes(std::string_view bytes, uint32_t next)
+    {
+        for (size_t i = 0; i < bytes.size(); ++i) {
+            const auto ch = static_cast<uint8_t>(bytes[reverse_ ? i : bytes.size() - 1 - i]);
+            next = addByteRange(ch, ch, next);
+        }
+        return next;
+    }
+
+    uint32_t compileClass(const CodePointRanges& ranges, uint32_t next)
+    {
+        if (ranges.empty()) // matches nothing
+            return addByteRange(1, 0, next);
+
+        std::vector<std::vector<std::pair<uint8_t, uint8_t>>> sequences;
+        for (const auto& [lo, hi] : ranges)
+            getUtf8Sequences(lo, hi, sequences);
+        std::vector<uint32_t> alternatives;
+        for (const auto& seq : sequences) {
+            auto first = next;
+            for (size_t i = 0; i < seq.size(); ++i) {
+                const auto& [lo, hi] = seq[reverse_ ? i : seq.size() - 1 - i];
+                first = addByteRange(lo, hi, first);
+            }
+            alternatives.push_back(first);
+        }
+        return addSplits(alternatives);
+    }
+
+    uint32_t compileRepeat(const Node& node, uint32_t next)
+    {
+        const auto& child = node.children[0];
+        const auto split = [&](uint32_t body, uint32_t skip) {
+            return node.greedy ? addSplit(body, skip) : addSplit(skip, body);
+        };
+
+        auto first = next;
+        if (node.max == Unbounded) {
+            // The loop has to exist before we can compile the body, which jumps back to it
+            const auto loop = addSplit(0, 0);
+            const auto body = compile(child, loop);
+            program_[loop].out = node.greedy ? body : next;
+            program_[loop].out1 = node.greedy ? next : body;
+            first = loop;
+        } else {
+            // x{0,3} is (x(x(x)?)?)?
+            for (size_t i = node.min; i < node.max && !tooLarge(); ++i)
+                first = split(compile(child, first), next);
+        }
+        for (size_t i = 0; i < node.min && !tooLarge(); ++i)
+            first = compile(child, first);
+        return first;
+    }
+
+    bool reverse_;
+    Program program_;
+};
+
+// What is before or after a position, which is all we need to know for the assertions
+enum class Context : uint8_t { Other, Word, Newline };
+
+Context getContext(uint8_t ch)
+{
+    if (ch == '\n')
+        return Context::Newline;
+    return isWordByte(ch) ? Context::Word : Context::Other;
+}
+
+// A DFA state is the (ordered) list of NFA states we could be in. They are created as the search
+// needs them and the transitions are cached in a table.
+// "$" and "\b" depend on the next byte, so states containing those assertions are "pending" and
+// have to be resolved with the next byte before they can be used.
+// In leftmost-first mode (forward) the list is cut after the first Match, so only the threads that
+// the pattern prefers over that match survive. In longest mode (reverse), nothing is cut.
+// A state id is the offset of its row in the transition table. The first entry of every row holds
+// the flags of the state, so a step of the search is only two loads from the same cache line.
+class Dfa {
+public:
+    static constexpr int32_t DeadState = 0;
+
+    Dfa(const Program& program, uint32_t start, bool longest)
+        : program_(program)
+        , start_(start)
+        , longest_(longest)
+        , sparse_(program.size())
+        , dense_(program.size())
+    {
+        std::array<bool, 257> boundaries {};
+        for (const auto& inst : program_) {
+            if (inst.op == Inst::Op::ByteRange && inst.lo <= inst.hi) {
+                boundaries[inst.lo] = true;
+                boundaries[inst.hi + 1] = true;
+            }
+        }
+        // The bytes in a class also have to have the same Context
+        for (const auto& [lo, hi] : { std::pair('\n', '\n'), std::pair('0', '9'),
+                 std::pair('A', 'Z'), std::pair('_', '_'), std::pair('a', 'z') }) {
+            boundaries[static_cast<uint8_t>(lo)] = true;
+            boundaries[static_cast<uint8_t>(hi) + 1] = true;
+        }
+        uint8_t cls = 0;
+        for (size_t b = 1; b < 256; ++b) {
+            if (boundaries[b])
+                cls++;
+            classes_[b] = cls;
+        }
+        rowSize_ = static_cast<size_t>(cls) + 2;
+        reset();
+    }
+
+    enum Flags : int32_t { Pending = 1, Match = 2, Start = 4 };
+
+    int32_t getStartState(Context prev)
+    {
+        auto& state = startStates_[static_cast<size_t>(prev)];
+        if (state < 0) {
+            beginList();
+            addThread(start_, prev, std::nullopt);
+            state = addState(prev);
+            // We are back in this state, if nothing is in progress
+            transitions_[state] |= Start;
+        }
+        return state;
+    }
+
+    int32_t getFlags(int32_t state) const
+    {
+        return transitions_[state];
+    }
+
+    int32_t resolve(int32_t state, Context next)
+    {
+        const auto cached = getState(state).resolved[static_cast<size_t>(next)];
+        if (cached >= 0)
+            return cached;
+
+        const auto generation = generation_;
+        const auto prev = getState(state).prev;
+        const auto insts = getState(state).insts;
+        beginList();
+        for (const auto inst : insts)
+            addThread(inst, prev, next);
+        const auto resolved = addState(Context::Other);
+        if (generation == generation_)
+            getState(state).resolved[static_cast<size_t>(next)] = resolved;
+        return resolved;
+    }
+
+    // state must not be pending
+    int32_t next(int32_t state, uint8_t byte)
+    {
+        const auto cached = transitions_[static_cast<size_t>(state) + 1 + classes_[byte]];
+        return cached >= 0 ? cached : computeNext(state, byte);
+    }
+
+private:
+    struct State {
+        std::vector<uint32_t> insts;
+        Context prev; // only needed if pending
+        std::array<int32_t, 3> resolved { -1, -1, -1 };
+    };
+
+    State& getState(int32_t state)
+    {
+        return states_[static_cast<size_t>(state) / rowSize_];
+    }
+
+    int32_t computeNext(int32_t state, uint8_t byte)
+    {
+        const auto generation = generation_;
+        const auto insts = getState(state).insts;
+        const auto context = getContext(byte);
+        beginList();
+        for (const auto i : insts) {
+            const auto& inst = program_[i];
+            if (cut_)
+                break;
+            if (inst.op == Inst::Op::ByteRange && byte >= inst.lo && byte <= inst.hi)
+                addThread(inst.out, context, std::nullopt);
+        }
+        const auto target = addState(context);
+        if (generation == generation_)
+            transitions_[static_cast<size_t>(state) + 1 + classes_[byte]] = target;
+        return target;
+    }
+
+    void reset()
+    {
+        states_.clear();
+        transitions_.clear();
+        stateMap_.clear();
+        startStates_.fill(-1);
+        generation_++;
+        // The dead state transitions to itself
+        states_.push_back(State { {}, Context::Other });
+        transitions_.resize(rowSize_, DeadState);
+    }
+
+    void beginList()
+    {
+        list_.clear();
+        size_ = 0;
+        cut_ = false;
+    }
+
+    bool visit(uint32_t inst)
+    {
+        const auto idx = sparse_[inst];
+        if (idx < size_ && dense_[idx] == inst)
+            return false;
+        sparse_[inst] = size_;
+        dense_[size_++] = inst;
+        return true;
+    }
+
+    // Returns std::nullopt if we don't know yet
+    static std::optional<bool> check(
+        Assertion assertion, Context prev, std::optional<Context> next)
+    {
+        if (assertion == Assertion::PrevNewline)
+            return prev == Context::Newline;
+        if (!next)
+            return std::nullopt;
+        if (assertion == Assertion::NextNewline)
+            return *next == Context::Newline;
+        const auto boundary = (prev == Context::Word) != (*next == Context::Word);
+        return assertion == Assertion::WordBoundary ? boundary : !boundary;
+    }
+
+    // Adds inst and everything we can reach from it without consuming a byte to list_, in the
+    // order of priority (depth first, preferred branch first).
+    void addThread(uint32_t first, Context prev, std::optional<Context> next)
+    {
+        stack_.clear();
+        stack_.push_back(first);
+        while (!stack_.empty() && !cut_) {
+            const auto i = stack_.back();
+            stack_.pop_back();
+            if (!visit(i))
+                continue;
+            const auto& inst = program_[i];
+            switch (inst.op) {
+            case Inst::Op::ByteRange:
+                list_.push_back(i);
+                break;
+            case Inst::Op::Match:
+                list_.push_back(i);
+                cut_ = !longest_;
+                break;
+            case Inst::Op::Split:
+                stack_.push_back(inst.out1);
+                stack_.push_back(inst.out);
+                break;
+            case Inst::Op::Assert:
+                if (const auto res = check(inst.assertion, prev, next)) {
+                    if (*res)
+                        stack_.push_back(inst.out);
+                } else {
+                    list_.push_back(i);
+                }
+                break;
+            }
+        }
+    }
+
+    int32_t addState(Context prev)
+    {
+        if (list_.empty())
+            return DeadState;
+
+        int32_t flags = 0;
+        for (const auto i : list_) {
+            if (program_[i].op == Inst::Op::Assert)
+                flags |= Pending;
+            else if (program_[i].op == Inst::Op::Match)
+                flags |= Match;
+        }
+        if (!(flags & Pending))
+            prev = Context::Other;
+
+        std::string key(1 + list_.size() * sizeof(uint32_t), static_cast<char>(prev));
+        std::memcpy(key.data() + 1, list_.data(), list_.size() * sizeof(uint32_t));
+        if (const auto it = stateMap_.find(key); it != stateMap_.end())
+            return it->second;
+
+        if (states_.size() >= MaxDfaStates)
+            reset();
+        const auto id = static_cast<int32_t>(transitions_.size());
+        states_.push_back(State { list_, prev });
+        transitions_.resize(transitions_.size() + rowSize_, -1);
+        transitions_[id] = flags;
+        stateMap_.emplace(std::move(key), id);
+        return id;
+    }
+
+    const Program& program_;
+    uint32_t start_;
+    bool longest_;
+    std::array<uint8_t, 256> classes_ {}; // bytes that behave the same have the same class
+    size_t rowSize_ = 0; // flags + one for every class
+
+    std::vector<State> states_;
+    // [state + 1 + class] is the next state, -1 if we didn't compute it yet
+    std::vector<int32_t> transitions_;
+    std::unordered_map<std::string, int32_t> stateMap_; // Context + insts -> state
+    std::array<int32_t, 3> startStates_;
+    size_t generation_ = 0; // incremented by reset, so we don't cache states from before
+
+    // Used while building states
+    std::vector<uint32_t> list_;
+    std::vector<uint32_t> stack_;
+    bool cut_ = false;
+    // A sparse set, so we can clear it in O(1)
+    std::vector<uint32_t> sparse_;
+    std::vector<uint32_t> dense_;
+    size_t size_ = 0;
+};
+
+Context getContextBefore(const TextBuffer& text, size_t offset)
+{
+    return offset > 0 ? getContext(static_cast<uint8_t>(text[offset - 1])) : Context::Newline;
+}
+
+Context getContextAt(const TextBuffer& text, size_t offset)
+{
+    return offset < text.getSize() ? getContext(static_cast<uint8_t>(text[offset]))
+                                   : Context::Newline;
+}
+}
+
+struct Regex::Impl {
+    std::string pattern;
+    Program forward;
+    Program reverse;
+    Dfa forwardDfa;
+    Dfa reverseDfa;
+    // The search jumps from one occurence of the prefix to the next, as long as nothing else is
+    // in progress. If the required literal does not occur at all, we don't have to search.
+    std::optional<search::Pattern> prefix;
+    std::optional<search::Pattern> required;
+
+    Impl(std::string pattern, Program forward, uint32_t forwardStart, Program reverse,
+        uint32_t reverseStart)
+        : pattern(std::move(pattern))
+        , forward(std::move(forward))
+        , reverse(std::move(reverse))
+        , forwardDfa(this->forward, forwardStart, false)
+        , reverseDfa(this->reverse, reverseStart, true)
+    {
+    }
+
+    // Returns the end of the preferred match of the leftmost ones or npos
+    size_t findEnd(const TextBuffer& text, size_t offset, size_t end)
+    {
+        auto& dfa = forwardDfa;
+        const auto jump = prefix.has_value();
+        size_t lastMatch = npos;
+        size_t pos = offset;
+        auto state = Dfa::DeadState;
+        while (true) {
+            if (jump) {
+                pos = prefix->find(text, pos, end);
+                if (pos == npos)
+                    return lastMatch;
+            }
+            state = dfa.getStartState(getContextBefore(text, pos));
+            text.forEachChunk(pos, end, [&](std::string_view chunk) {
+                // Work on copies, so the compiler can keep them in registers
+                auto current = state;
+                size_t i = 0;
+                bool stop = false;
+                while (i < chunk.size() && !stop) {
+                    const auto byte = static_cast<uint8_t>(chunk[i]);
+                    if (dfa.getFlags(current) & Dfa::Pending)
+                        current = dfa.resolve(current, getContext(byte));
+                    if (dfa.getFlags(current) & Dfa::Match)
+                        lastMatch = pos + i;
+                    current = dfa.next(current, byte);
+                    i++;
+                    stop = current == Dfa::DeadState
+                        || (jump && (dfa.getFlags(current) & Dfa::Start));
+                }
+                state = current;
+                pos += i;
+                return !stop;
+            });
+            if (state == Dfa::DeadState)
+                return lastMatch;
+            if (!jump || !(dfa.getFlags(state) & Dfa::Start) || pos == end)
+                break;
+        }
+
+        if (dfa.getFlags(dfa.resolve(state, getContextAt(text, end))) & Dfa::Match)
+            lastMatch = end;
+        return lastMatch;
+    }
+
+    // Returns where the match ending at matchEnd starts (the first possible position >= offset)
+    size_t findStart(const TextBuffer& text, size_t offset, size_t matchEnd)
+    {
+        auto& dfa = reverseDfa;
+        size_t lastMatch = npos;
+        size_t pos = matchEnd;
+        // Backwards the byte after the match is the one "before"
+        auto state = dfa.getStartState(getContextAt(text, matchEnd));
+        text.forEachChunkBackwards(offset, matchEnd, [&](std::string_view chunk) {
+            auto current = state;
+            size_t i = chunk.size();
+            while (i > 0 && current != Dfa::DeadState) {
+                const auto byte = static_cast<uint8_t>(chunk[i - 1]);
+                if (dfa.getFlags(current) & Dfa::Pending)
+                    current = dfa.resolve(current, getContext(byte));
+                if (dfa.getFlags(current) & Dfa::Match)
+                    lastMatch = pos - (chunk.size() - i);
+                current = dfa.next(current, byte);
+                i--;
+            }
+            state = current;
+            pos -= chunk.size() - i;
+            return current != Dfa::DeadState;
+        });
+        if (state != Dfa::DeadState
+            && (dfa.getFlags(dfa.resolve(state, getContextBefore(text, offset))) & Dfa::Match))
+            lastMatch = offset;
+        return lastMatch;
+    }
+};
+
+Regex::Regex(std::shared_ptr<Impl> impl)
+    : impl_(std::move(impl))
+{
+}
+
+Result<Regex, std::string> Regex::compile(std::string_view pattern)
+{
+    Parser parser(pattern);
+    const auto node = parser.parse();
+    if (!node)
+        return error(std::string(parser.getError()));
+
+    Compiler forward(false);
+    // Empty matches are useless for find. If we only skipped them after we found them, patterns
+    // like "x?" would restart the search at every byte.
+    const auto regexStart = forward.compileNonEmpty(forward.compile(*node, 0));
+    // Unanchored search: the preferred branch starts a match here, the other one skips a byte
+    // and comes back. This way matches that start earlier have the higher priority.
+    const auto unanchoredStart = forward.addSplit(regexStart, 0);
+    forward.getProgram()[unanchoredStart].out1 = forward.addByteRange(0, 255, unanchoredStart);
+
+    Compiler reverse(true);
+    const auto reverseStart = reverse.compile(*node, 0);
+    if (forward.tooLarge() || reverse.tooLarge())
+        return error(std::string("Pattern is too large"));
+
+    auto impl = std::make_shared<Impl>(std::string(pattern), std::move(forward.getProgram()),
+        unanchoredStart, std::move(reverse.getProgram()), reverseStart);
+    const auto prefix = getPrefix(*node);
+    const auto required = getRequired(*node);
+    if (!prefix.empty())
+        impl->prefix.emplace(prefix);
+    if (!required.empty() && required != prefix)
+        impl->required.emplace(required);
+    return Regex(std::move(impl));
+}
+
+const std::string& Regex::getPattern() const
+{
+    return impl_->pattern;
+}
+
+std::optional<Range> Regex::find(const TextBuffer& text, size_t offset, size_t end) const
+{
+    end = std::min(end, text.getSize());
+    if (offset > end)
+        return std::nullopt;
+    if (impl_->required && impl_->required->find(text, offset, end) == npos)
+        return std::nullopt;
+
+    const auto matchEnd = impl_->findEnd(text, offset, end);
+    if (matchEnd == npos)
+        return std::nullopt;
+    const auto matchStart = impl_->findStart(text, offset, matchEnd);
+    assert(matchStart != npos && matchStart < matchEnd);
+    return Range { matchStart, matchEnd - matchStart };
+}
+
+std::vector<Range> Regex::findAll(const TextBuffer& text, size_t offset, size_t end) const
+{
+    std::vector<Range> matches;
+    while (const auto match = find(text, offset, end)) {
+        matches.push_back(*match);
+        offset = match->end();
+    }
+    return matches;
+}
+}
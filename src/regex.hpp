@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "result.hpp"
+#include "textbuffer.hpp"
+#include "util.hpp"
+
+// Regular expressions for find. The pattern is compiled to an NFA (Thompson's construction) and
+// while searching, the DFA states are built from it as we need them (like RE2 does). There is no
+// backtracking, so a search takes linear time in the size of the text, whatever the pattern is.
+// Supported: literals, ".", classes ("[a-z]", "[^...]"), escapes (\d \w \s \D \W \S \n \t \r \f
+// \v \0 \xHH \. etc.), groups ("(...)", "(?:...)"), "|", "*", "+", "?", "{n}", "{n,}", "{n,m}"
+// (and the lazy versions), "^" and "$" (start/end of line) and "\b", "\B".
+// The pattern and the text are utf8, but \d, \w, \s and \b are ASCII only.
+namespace regex {
+class Regex {
+public:
+    // Returns an error message if the pattern is invalid
+    static Result<Regex, std::string> compile(std::string_view pattern);
+
+    const std::string& getPattern() const;
+
+    // Returns the first match in [offset, end), that is not empty. Like in Perl or JavaScript, it's
+    // the leftmost match and of the matches starting there, the one the pattern prefers, e.g.
+    // "a|ab" matches "a" and "a+?" matches a single "a". Empty matches are never considered, so
+    // "a??" matches "a" too. This does not copy the text.
+    // The DFA is built while searching and copies of a Regex share it, so only use them on one
+    // thread.
+    std::optional<Range> find(
+        const TextBuffer& text, size_t offset = 0, size_t end = std::string_view::npos) const;
+    // The search continues after the end of every match (like the find command counts matches)
+    std::vector<Range> findAll(
+        const TextBuffer& text, size_t offset = 0, size_t end = std::string_view::npos) const;
+
+private:
+    struct Impl;
+
+    Regex(std::shared_ptr<Impl> impl);
+
+    std::shared_ptr<Impl> impl_;
+};
+}
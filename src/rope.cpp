@@ -0,0 +1,361 @@
+#include "rope.hpp"
+
+#include <cassert>
+#include <tuple>
+#include <vector>
+
+#include "newline.hpp"
+#include "utf8.hpp"
+
+namespace {
+// Small enough that copying a leaf on every keystroke is cheap, large enough that the tree stays
+// shallow and the overhead per node is small compared to the text.
+constexpr size_t MaxLeafSize = 2048;
+// When building a rope from a string, leave some space in the leaves for insertions
+constexpr size_t BuildLeafSize = MaxLeafSize / 2;
+}
+
+struct Rope::Node {
+    NodePtr left;
+    NodePtr right;
+    std::string text; // only used in leaves
+    size_t size = 0;
+    size_t newlines = 0;
+    uint8_t height = 0; // leaves have height 0
+
+    bool isLeaf() const
+    {
+        return !left;
+    }
+};
+
+Rope::Rope()
+{
+}
+
+Rope::Rope(std::string_view str)
+    : root_(build(str))
+{
+}
+
+size_t Rope::getSize() const
+{
+    return root_ ? root_->size : 0;
+}
+
+size_t Rope::getNewlineCount() const
+{
+    return root_ ? root_->newlines : 0;
+}
+
+char Rope::operator[](size_t offset) const
+{
+    assert(offset < getSize());
+    if (!cacheLeaf_ || offset < cacheLeafOffset_
+        || offset - cacheLeafOffset_ >= cacheLeaf_->text.size()) {
+        std::tie(cacheLeaf_, cacheLeafOffset_) = findLeaf(offset);
+    }
+    return cacheLeaf_->text[offset - cacheLeafOffset_];
+}
+
+std::string Rope::getString(const Range& range) const
+{
+    assert(range.offset + range.length <= getSize());
+    std::string str;
+    str.reserve(range.length);
+    size_t offset = range.offset;
+    while (offset < range.end()) {
+        const auto chunk = getChunk(offset);
+        const auto len = std::min(chunk.size(), range.end() - offset);
+        str.append(chunk.data(), len);
+        offset += len;
+    }
+    return str;
+}
+
+std::string_view Rope::getChunk(size_t offset) const
+{
+    assert(offset <= getSize());
+    if (offset == getSize())
+        return std::string_view();
+    const auto [leaf, leafOffset] = findLeaf(offset);
+    return std::string_view(leaf->text).substr(offset - leafOffset);
+}
+
+bool Rope::forEachChunk(
+    size_t offset, size_t end, const std::function<bool(std::string_view)>& func) const
+{
+    end = std::min(end, getSize());
+    if (offset >= end)
+        return true;
+    return forEachChunk(root_.get(), offset, end, func);
+}
+
+bool Rope::forEachChunkBackwards(
+    size_t offset, size_t end, const std::function<bool(std::string_view)>& func) const
+{
+    end = std::min(end, getSize());
+    if (offset >= end)
+        return true;
+    return forEachChunkBackwards(root_.get(), offset, end, func);
+}
+
+size_t Rope::countNewlines(size_t offset) const
+{
+    assert(offset <= getSize());
+    if (offset == getSize())
+        return getNewlineCount();
+
+    const Node* node = root_.get();
+    size_t count = 0;
+    while (!node->isLeaf()) {
+        if (offset < node->left->size) {
+            node = node->left.get();
+        } else {
+            count += node->left->newlines;
+            offset -= node->left->size;
+            node = node->right.get();
+        }
+    }
+    return count + newline::count(std::string_view(node->text).substr(0, offset));
+}
+
+size_t Rope::findNewline(size_t n) const
+{
+    assert(n < getNewlineCount());
+    const Node* node = root_.get();
+    size_t offset = 0;
+    while (!node->isLeaf()) {
+        if (n < node->left->newlines) {
+            node = node->left.get();
+        } else {
+            n -= node->left->newlines;
+            offset += node->left->size;
+            node = node->right.get();
+        }
+    }
+
+    const auto idx = newline::find(node->text, n);
+    assert(idx != std::string_view::npos);
+    return offset + idx;
+}
+
+void Rope::insert(size_t offset, std::string_view str)
+{
+    assert(offset <= getSize());
+    if (str.empty())
+        return;
+    cacheLeaf_ = nullptr;
+
+    if (auto node = editLeaf(root_, offset, 0, str)) {
+        root_ = std::move(node);
+        return;
+    }
+
+    const auto [left, right] = split(root_, offset);
+    root_ = join(join(left, build(str)), right);
+}
+
+void Rope::remove(const Range& range)
+{
+    assert(range.offset + range.length <= getSize());
+    if (range.length == 0)
+        return;
+    cacheLeaf_ = nullptr;
+
+    if (auto node = editLeaf(root_, range.offset, range.length, "")) {
+        root_ = std::move(node);
+        return;
+    }
+
+    const auto [left, rest] = split(root_, range.offset);
+    const auto right = split(rest, range.length).second;
+    root_ = join(left, right);
+}
+
+Rope::NodePtr Rope::makeLeaf(std::string text)
+{
+    if (text.empty())
+        return nullptr;
+    auto node = std::make_shared<Node>();
+    node->size = text.size();
+    node->newlines = newline::count(text);
+    node->text = std::move(text);
+    return node;
+}
+
+Rope::NodePtr Rope::makeNode(NodePtr left, NodePtr right)
+{
+    assert(left && right);
+    auto node = std::make_shared<Node>();
+    node->size = left->size + right->size;
+    node->newlines = left->newlines + right->newlines;
+    node->height = std::max(left->height, right->height) + 1;
+    node->left = std::move(left);
+    node->right = std::move(right);
+    return node;
+}
+
+// Creates a node from two subtrees, whose heights may differ by at most 2
+Rope::NodePtr Rope::balance(NodePtr left, NodePtr right)
+{
+    const auto leftHeight = static_cast<int>(left->height);
+    const auto rightHeight = static_cast<int>(right->height);
+    if (leftHeight > rightHeight + 1) {
+        assert(!left->isLeaf());
+        if (left->left->height < left->right->height) {
+            // left-right case
+            const auto& lr = left->right;
+            return makeNode(makeNode(left->left, lr->left), makeNode(lr->right, right));
+        }
+        return makeNode(left->left, makeNode(left->right, right));
+    } else if (rightHeight > leftHeight + 1) {
+        assert(!right->isLeaf());
+        if (right->right->height < right->left->height) {
+            // right-left case
+            const auto& rl = right->left;
+            return makeNode(makeNode(left, rl->left), makeNode(rl->right, right->right));
+        }
+        return makeNode(makeNode(left, right->left), right->right);
+    }
+    return makeNode(std::move(left), std::move(right));
+}
+
+Rope::NodePtr Rope::join(const NodePtr& left, const NodePtr& right)
+{
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+    // Merge small leaves, so the tree does not degenerate into single characters
+    if (left->isLeaf() && right->isLeaf() && left->size + right->size <= MaxLeafSize)
+        return makeLeaf(left->text + right->text);
+    // Walk down the spine of the taller tree until the heights match up
+    if (left->height > right->height + 1)
+        return balance(left->left, join(left->right, right));
+    if (right->height > left->height + 1)
+        return balance(join(left, right->left), right->right);
+    return makeNode(left, right);
+}
+
+std::pair<Rope::NodePtr, Rope::NodePtr> Rope::split(const NodePtr& node, size_t offset)
+{
+    if (!node || offset == 0)
+        return std::pair(nullptr, node);
+    if (offset >= node->size)
+        return std::pair(node, nullptr);
+    if (node->isLeaf())
+        return std::pair(
+            makeLeaf(node->text.substr(0, offset)), makeLeaf(node->text.substr(offset)));
+
+    if (offset <= node->left->size) {
+        auto [left, right] = split(node->left, offset);
+        return std::pair(std::move(left), join(right, node->right));
+    }
+    auto [left, right] = split(node->right, offset - node->left->size);
+    return std::pair(join(node->left, left), std::move(right));
+}
+
+Rope::NodePtr Rope::build(std::string_view str)
+{
+    std::vector<NodePtr> nodes;
+    nodes.reserve(str.size() / BuildLeafSize + 1);
+    size_t offset = 0;
+    while (offset < str.size()) {
+        auto end = std::min(offset + BuildLeafSize, str.size());
+        // Don't split code points, so every chunk is valid utf8 on it's own (if the input is)
+        while (end < str.size() && end > offset + 1 && utf8::isContinuationByte(str[end]))
+            end--;
+        nodes.push_back(makeLeaf(std::string(str.substr(offset, end - offset))));
+        offset = end;
+    }
+
+    return buildTree(nodes, 0, nodes.size());
+}
+
+// Splitting the leaves in the middle recursively results in a perfectly balanced tree
+Rope::NodePtr Rope::buildTree(std::vector<NodePtr>& leaves, size_t first, size_t last)
+{
+    if (first == last)
+        return nullptr;
+    if (last - first == 1)
+        return std::move(leaves[first]);
+    const auto mid = first + (last - first) / 2;
+    return makeNode(buildTree(leaves, first, mid), buildTree(leaves, mid, last));
+}
+
+Rope::NodePtr Rope::editLeaf(
+    const NodePtr& node, size_t offset, size_t removeLength, std::string_view insertStr)
+{
+    if (!node)
+        return nullptr;
+
+    if (node->isLeaf()) {
+        assert(offset + removeLength <= node->size);
+        const auto newSize = node->size - removeLength + insertStr.size();
+        // Internal nodes always have two children, so we can't produce empty leaves
+        if (newSize > MaxLeafSize || newSize == 0)
+            return nullptr;
+        auto text = node->text;
+        text.replace(offset, removeLength, insertStr);
+        return makeLeaf(std::move(text));
+    }
+
+    const auto leftSize = node->left->size;
+    // Insertions at the boundary between two leaves go into the left one (appending is common)
+    if (offset + removeLength <= leftSize) {
+        auto left = editLeaf(node->left, offset, removeLength, insertStr);
+        return left ? makeNode(std::move(left), node->right) : nullptr;
+    } else if (offset >= leftSize) {
+        auto right = editLeaf(node->right, offset - leftSize, removeLength, insertStr);
+        return right ? makeNode(node->left, std::move(right)) : nullptr;
+    }
+    return nullptr; // edit spans multiple leaves
+}
+
+bool Rope::forEachChunk(const Node* node, size_t offset, size_t end,
+    const std::function<bool(std::string_view)>& func)
+{
+    if (node->isLeaf())
+        return func(std::string_view(node->text).substr(offset, end - offset));
+
+    const auto leftSize = node->left->size;
+    if (offset < leftSize && !forEachChunk(node->left.get(), offset, std::min(end, leftSize), func))
+        return false;
+    if (end > leftSize)
+        return forEachChunk(
+            node->right.get(), offset > leftSize ? offset - leftSize : 0, end - leftSize, func);
+    return true;
+}
+
+bool Rope::forEachChunkBackwards(const Node* node, size_t offset, size_t end,
+    const std::function<bool(std::string_view)>& func)
+{
+    if (node->isLeaf())
+        return func(std::string_view(node->text).substr(offset, end - offset));
+
+    const auto leftSize = node->left->size;
+    if (end > leftSize
+        && !forEachChunkBackwards(node->right.get(), offset > leftSize ? offset - leftSize : 0,
+            end - leftSize, func))
+        return false;
+    if (offset < leftSize)
+        return forEachChunkBackwards(node->left.get(), offset, std::min(end, leftSize), func);
+    return true;
+}
+
+std::pair<const Rope::Node*, size_t> Rope::findLeaf(size_t offset) const
+{
+    assert(root_ && offset < root_->size);
+    const Node* node = root_.get();
+    size_t nodeOffset = 0;
+    while (!node->isLeaf()) {
+        if (offset - nodeOffset < node->left->size) {
+            node = node->left.get();
+        } else {
+            nodeOffset += node->left->size;
+            node = node->right.get();
+        }
+    }
+    return std::pair(node, nodeOffset);
+}
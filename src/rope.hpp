@@ -0,0 +1,73 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util.hpp"
+
+// https://en.wikipedia.org/wiki/Rope_(data_structure)
+// This is an AVL tree with chunks of text in it's leaves. Nodes are never modified after they are
+// created (edits copy the path from the root to the changed leaves), so copying a Rope is O(1) and
+// the copy will not see any later modifications of the original.
+class Rope {
+public:
+    Rope();
+    Rope(std::string_view str);
+
+    size_t getSize() const;
+    size_t getNewlineCount() const;
+
+    char operator[](size_t offset) const;
+    std::string getString(const Range& range) const;
+    // Returns the rest of the chunk that contains offset. Empty if offset == getSize().
+    // You can iterate over all the text by calling this repeatedly with offset += chunk.size().
+    std::string_view getChunk(size_t offset) const;
+    // Calls func with all the chunks in [offset, end) in order, until it returns false.
+    // This is faster than calling getChunk repeatedly, because it doesn't start at the root for
+    // every chunk. Returns false if func did.
+    bool forEachChunk(
+        size_t offset, size_t end, const std::function<bool(std::string_view)>& func) const;
+    // The same, but starting with the chunk that contains end - 1
+    bool forEachChunkBackwards(
+        size_t offset, size_t end, const std::function<bool(std::string_view)>& func) const;
+
+    // Returns the number of newlines in [0, offset)
+    size_t countNewlines(size_t offset) const;
+    // Returns the offset of the n-th (starting at 0) newline. n must be < getNewlineCount().
+    size_t findNewline(size_t n) const;
+
+    void insert(size_t offset, std::string_view str);
+    void remove(const Range& range);
+
+private:
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    static NodePtr makeLeaf(std::string text);
+    static NodePtr makeNode(NodePtr left, NodePtr right);
+    static NodePtr balance(NodePtr left, NodePtr right);
+    static NodePtr join(const NodePtr& left, const NodePtr& right);
+    static std::pair<NodePtr, NodePtr> split(const NodePtr& node, size_t offset);
+    static NodePtr build(std::string_view str);
+    static NodePtr buildTree(std::vector<NodePtr>& leaves, size_t first, size_t last);
+    // Returns nullptr if the edit does not fit into a single leaf
+    static NodePtr editLeaf(
+        const NodePtr& node, size_t offset, size_t removeLength, std::string_view insertStr);
+
+    // offset and end are relative to node
+    static bool forEachChunk(const Node* node, size_t offset, size_t end,
+        const std::function<bool(std::string_view)>& func);
+    static bool forEachChunkBackwards(const Node* node, size_t offset, size_t end,
+        const std::function<bool(std::string_view)>& func);
+
+    // Returns the leaf containing offset and the offset of the start of that leaf
+    std::pair<const Node*, size_t> findLeaf(size_t offset) const;
+
+    NodePtr root_;
+    // Most accesses via operator[] are sequential, so we remember the last leaf
+    mutable const Node* cacheLeaf_ = nullptr;
+    mutable size_t cacheLeafOffset_ = 0;
+};
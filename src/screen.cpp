@@ -0,0 +1,398 @@
+#include "screen.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+#include "control.hpp"
+#include "terminal.hpp"
+#include "utf8.hpp"
+
+namespace {
+// If there are only a few unchanged cells between two changed ones, it's cheaper to just write
+// them again than to move the cursor over them ("\x1b[4C" is already 4 bytes)
+constexpr size_t MaxRewriteGap = 3;
+// Setting up the scroll region costs about as much as drawing a short line, so only do it if we
+// don't have to redraw at least this many lines
+constexpr size_t MinScrollSavedLines = 2;
+}
+
+bool Screen::Cell::sameStyle(const Cell& other) const
+{
+    return fg == other.fg && bg == other.bg && attributes == other.attributes;
+}
+
+bool Screen::Cell::operator==(const Cell& other) const
+{
+    return sameStyle(other) && glyphLength == other.glyphLength
+        && std::equal(glyph.begin(), glyph.begin() + glyphLength, other.glyph.begin());
+}
+
+bool Screen::Cell::operator!=(const Cell& other) const
+{
+    return !(*this == other);
+}
+
+Screen::Screen()
+    : colors_ { "" }
+{
+}
+
+void Screen::resize(const Vec& size)
+{
+    if (size == size_)
+        return;
+    size_ = size;
+    back_.assign(size_.x * size_.y, Cell {});
+    front_.assign(size_.x * size_.y, Cell {});
+    invalidate();
+}
+
+const Vec& Screen::getSize() const
+{
+    return size_;
+}
+
+void Screen::invalidate()
+{
+    repaint_ = true;
+}
+
+void Screen::clear()
+{
+    std::fill(back_.begin(), back_.end(), Cell {});
+    cursor_ = Vec { 0, 0 };
+    resetStyle();
+}
+
+void Screen::moveCursor(const Vec& position)
+{
+    cursor_ = position;
+}
+
+void Screen::moveCursorForward(size_t num)
+{
+    cursor_.x += num;
+}
+
+void Screen::newline()
+{
+    cursor_ = Vec { 0, cursor_.y + 1 };
+}
+
+const Vec& Screen::getCursor() const
+{
+    return cursor_;
+}
+
+void Screen::setFgColor(std::string_view color)
+{
+    if (color != colors_[style_.fg])
+        style_.fg = getColorId(color);
+}
+
+void Screen::setBgColor(std::string_view color)
+{
+    if (color != colors_[style_.bg])
+        style_.bg = getColorId(color);
+}
+
+void Screen::setAttribute(Attribute attribute, bool enabled)
+{
+    if (enabled)
+        style_.attributes.set(attribute);
+    else
+        style_.attributes.clear(attribute);
+}
+
+void Screen::resetStyle()
+{
+    style_ = Cell {};
+}
+
+void Screen::write(std::string_view str)
+{
+    size_t i = 0;
+    while (i < str.size()) {
+        auto len = std::min(utf8::getCodePointLength(str[i]), str.size() - i);
+        for (size_t j = 1; j < len; ++j) {
+            if (!utf8::isContinuationByte(str[i + j])) {
+                len = j;
+                break;
+            }
+        }
+
+        auto cell = style_;
+        std::copy(str.begin() + i, str.begin() + i + len, cell.glyph.begin());
+        cell.glyphLength = static_cast<uint8_t>(len);
+        put(cell);
+        i += len;
+    }
+}
+
+void Screen::write(char ch, size_t num)
+{
+    auto cell = style_;
+    cell.glyph[0] = ch;
+    cell.glyphLength = 1;
+    for (size_t i = 0; i < num; ++i)
+        put(cell);
+}
+
+void Screen::clearLine()
+{
+    // Erasing does not use the attributes
+    auto cell = Cell {};
+    cell.bg = style_.bg;
+    while (cursor_.x < size_.x)
+        put(cell);
+}
+
+void Screen::flush(const Vec& cursor)
+{
+    if (repaint_) {
+        terminal::bufferWrite(control::sgr::reset);
+        terminal::bufferWrite(control::clear);
+        // The terminal is empty now, so we only need to draw what is not empty
+        std::fill(front_.begin(), front_.end(), Cell {});
+        terminalStyle_ = Cell {};
+        terminalCursorValid_ = false;
+        repaint_ = false;
+    }
+
+    bool hidCursor = false;
+    if (const auto shift = findLineShift()) {
+        terminal::bufferWrite(control::hideCursor);
+        hidCursor = true;
+        shiftLines(*shift);
+    }
+
+    for (size_t y = 0; y < size_.y; ++y) {
+        for (size_t x = 0; x < size_.x; ++x) {
+            const auto idx = y * size_.x + x;
+            if (back_[idx] == front_[idx])
+                continue;
+
+            if (!hidCursor) {
+                terminal::bufferWrite(control::hideCursor);
+                hidCursor = true;
+            }
+            moveTerminalCursor(Vec { x, y });
+            writeCell(back_[idx]);
+            front_[idx] = back_[idx];
+        }
+    }
+
+    if (hidCursor || !terminalCursorValid_ || !(terminalCursor_ == cursor)) {
+        terminal::bufferWrite(control::moveCursor(cursor));
+        terminalCursor_ = cursor;
+        terminalCursorValid_ = true;
+    }
+    if (hidCursor)
+        terminal::bufferWrite(control::showCursor);
+    terminal::flushWrite();
+}
+
+uint16_t Screen::getColorId(std::string_view color)
+{
+    for (size_t i = 0; i < colors_.size(); ++i) {
+        if (colors_[i] == color)
+            return static_cast<uint16_t>(i);
+    }
+    colors_.emplace_back(color);
+    return static_cast<uint16_t>(colors_.size() - 1);
+}
+
+Screen::Cell* Screen::getCell(const Vec& position)
+{
+    if (position.x >= size_.x || position.y >= size_.y)
+        return nullptr;
+    return &back_[position.y * size_.x + position.x];
+}
+
+void Screen::put(const Cell& cell)
+{
+    if (auto c = getCell(cursor_))
+        *c = cell;
+    cursor_.x++;
+}
+
+uint64_t Screen::hashLine(const std::vector<Cell>& cells, size_t y) const
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](uint64_t v) {
+        hash ^= v;
+        hash *= 1099511628211ull;
+    };
+    for (size_t x = 0; x < size_.x; ++x) {
+        const auto& cell = cells[y * size_.x + x];
+        for (size_t i = 0; i < cell.glyphLength; ++i)
+            add(static_cast<uint8_t>(cell.glyph[i]));
+        add(cell.attributes.getMask());
+        add(cell.fg);
+        add(cell.bg);
+    }
+    return hash;
+}
+
+std::optional<Screen::LineShift> Screen::findLineShift() const
+{
+    if (repaint_)
+        return std::nullopt;
+
+    std::vector<uint64_t> backHashes(size_.y), frontHashes(size_.y);
+    size_t changedLines = 0;
+    for (size_t y = 0; y < size_.y; ++y) {
+        backHashes[y] = hashLine(back_, y);
+        frontHashes[y] = hashLine(front_, y);
+        if (backHashes[y] != frontHashes[y])
+            changedLines++;
+    }
+    if (changedLines < MinScrollSavedLines)
+        return std::nullopt;
+
+    // Find the offset and the run of consecutive lines that saves us from redrawing the most lines
+    std::optional<LineShift> best;
+    size_t bestSaved = MinScrollSavedLines - 1;
+    const auto height = static_cast<int>(size_.y);
+    for (int offset = 1 - height; offset < height; ++offset) {
+        if (offset == 0)
+            continue;
+        size_t first = 0;
+        size_t saved = 0;
+        bool inRun = false;
+        for (int y = std::max(0, -offset); y < std::min(height, height - offset); ++y) {
+            if (backHashes[y] != frontHashes[y + offset]) {
+                inRun = false;
+                continue;
+            }
+            if (!inRun) {
+                first = y;
+                saved = 0;
+                inRun = true;
+            }
+            if (backHashes[y] != frontHashes[y])
+                saved++;
+            if (saved > bestSaved) {
+                bestSaved = saved;
+                best = LineShift { first, static_cast<size_t>(y), offset };
+            }
+        }
+    }
+
+    if (!best)
+        return std::nullopt;
+
+    // Make sure it wasn't a hash collision
+    const auto lineSize = static_cast<std::ptrdiff_t>(size_.x);
+    for (size_t y = best->first; y <= best->last; ++y) {
+        const auto backLine = back_.begin() + y * lineSize;
+        const auto frontLine = front_.begin() + (y + best->offset) * lineSize;
+        if (!std::equal(backLine, backLine + lineSize, frontLine))
+            return std::nullopt;
+    }
+    return best;
+}
+
+void Screen::shiftLines(const LineShift& shift)
+{
+    const auto up = shift.offset > 0;
+    const auto num = static_cast<size_t>(std::abs(shift.offset));
+    const auto top = up ? shift.first : shift.first - num;
+    const auto bottom = up ? shift.last + num : shift.last;
+
+    // Lines that are scrolled in are filled with the current background color on some terminals
+    // and the default on others. If we reset it first, they are the same everywhere.
+    setTerminalStyle(Cell {});
+    terminal::bufferWrite(control::setScrollRegion(top, bottom));
+    terminal::bufferWrite(up ? control::scrollUp(num) : control::scrollDown(num));
+    terminal::bufferWrite(control::resetScrollRegion);
+    // Setting the scroll region moves the cursor to the top left
+    terminalCursor_ = Vec { 0, 0 };
+    terminalCursorValid_ = true;
+
+    const auto line = [this](size_t y) { return front_.begin() + y * size_.x; };
+    const auto moveLine = [this, &line](size_t from, size_t to) {
+        std::copy(line(from), line(from) + size_.x, line(to));
+    };
+    if (up) {
+        for (size_t y = top; y + num <= bottom; ++y)
+            moveLine(y + num, y);
+        std::fill(line(bottom + 1 - num), line(bottom + 1), Cell {});
+    } else {
+        for (size_t y = bottom; y >= top + num; --y)
+            moveLine(y - num, y);
+        std::fill(line(top), line(top + num), Cell {});
+    }
+}
+
+void Screen::moveTerminalCursor(const Vec& position)
+{
+    if (terminalCursorValid_ && terminalCursor_ == position)
+        return;
+
+    if (terminalCursorValid_ && position.y == terminalCursor_.y
+        && position.x > terminalCursor_.x) {
+        const auto gap = position.x - terminalCursor_.x;
+        const auto first = front_.begin() + position.y * size_.x + terminalCursor_.x;
+        const auto sameStyle = std::all_of(first, first + gap,
+            [this](const Cell& cell) { return cell.sameStyle(terminalStyle_); });
+        if (gap <= MaxRewriteGap && sameStyle) {
+            // These are unchanged, so front_ is what should be there
+            for (size_t x = terminalCursor_.x; x < position.x; ++x)
+                writeCell(front_[position.y * size_.x + x]);
+        } else {
+            terminal::bufferWrite(control::moveCursorForward(gap));
+        }
+    } else if (terminalCursorValid_ && position.x == 0 && position.y == terminalCursor_.y + 1) {
+        // This also works if the cursor is past the last column (see writeCell)
+        terminal::bufferWrite("\r\n");
+    } else if (terminalCursorValid_ && position.x == 0 && position.y == terminalCursor_.y) {
+        terminal::bufferWrite("\r");
+    } else {
+        terminal::bufferWrite(control::moveCursor(position));
+    }
+    terminalCursor_ = position;
+    terminalCursorValid_ = true;
+}
+
+void Screen::setTerminalStyle(const Cell& cell)
+{
+    if (cell.fg != terminalStyle_.fg) {
+        if (cell.fg == 0) {
+            terminal::bufferWrite(control::sgr::resetFgColor);
+        } else {
+            terminal::bufferWrite(control::sgr::fgColorPrefix);
+            terminal::bufferWrite(colors_[cell.fg]);
+        }
+    }
+
+    if (cell.bg != terminalStyle_.bg) {
+        if (cell.bg == 0) {
+            terminal::bufferWrite(control::sgr::resetBgColor);
+        } else {
+            terminal::bufferWrite(control::sgr::bgColorPrefix);
+            terminal::bufferWrite(colors_[cell.bg]);
+        }
+    }
+
+    const auto invert = cell.attributes.test(Attribute::Invert);
+    if (invert != terminalStyle_.attributes.test(Attribute::Invert))
+        terminal::bufferWrite(invert ? control::sgr::invert : control::sgr::resetInvert);
+
+    terminalStyle_.fg = cell.fg;
+    terminalStyle_.bg = cell.bg;
+    terminalStyle_.attributes = cell.attributes;
+}
+
+void Screen::writeCell(const Cell& cell)
+{
+    assert(terminalCursorValid_ && terminalCursor_.x < size_.x);
+    setTerminalStyle(cell);
+    terminal::bufferWrite(std::string_view(cell.glyph.data(), cell.glyphLength));
+    // After writing the last column, the cursor stays there until the next character is written
+    // (which would wrap). Carriage return still works though, so we remember it as x = size_.x,
+    // so relative movement is only ever done with "\r\n".
+    terminalCursor_.x++;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bitmask.hpp"
+#include "util.hpp"
+
+// Everything is drawn into an off-screen grid of cells first. The screen remembers what it sent to
+// the terminal last time, so flush() only has to write the cells that actually changed.
+// Like the rest of the editor, this assumes every code point takes up exactly one cell.
+class Screen {
+public:
+    enum class Attribute : uint8_t { Invert };
+
+    struct Cell {
+        std::array<char, 4> glyph { ' ' }; // a single utf8 code point
+        uint8_t glyphLength = 1;
+        Bitmask<Attribute> attributes;
+        // Indices into colors_, 0 is the terminal's default color
+        uint16_t fg = 0;
+        uint16_t bg = 0;
+
+        bool sameStyle(const Cell& other) const;
+        bool operator==(const Cell& other) const;
+        bool operator!=(const Cell& other) const;
+    };
+
+    Screen();
+
+    // Does nothing if the size did not change. Otherwise the next flush repaints everything.
+    void resize(const Vec& size);
+    const Vec& getSize() const;
+    // Use this if something else wrote to the terminal
+    void invalidate();
+
+    // Clears the whole grid and resets the cursor and the style
+    void clear();
+
+    void moveCursor(const Vec& position);
+    void moveCursorForward(size_t num);
+    void newline(); // like "\r\n"
+    const Vec& getCursor() const;
+
+    // Colors are the part after control::sgr::fgColorPrefix/bgColorPrefix, i.e. what you get from
+    // colorScheme. An empty string is the terminal's default color.
+    void setFgColor(std::string_view color);
+    void setBgColor(std::string_view color);
+    void setAttribute(Attribute attribute, bool enabled = true);
+    void resetStyle();
+
+    // Everything past the right edge is cut off.
+    void write(std::string_view str);
+    void write(char ch, size_t num = 1);
+    // Fills the rest of the line with spaces in the current background color (like "\x1b[K")
+    void clearLine();
+
+    // Writes everything that changed since the last flush to the terminal, puts the terminal
+    // cursor at cursor and flushes the terminal write buffer.
+    void flush(const Vec& cursor);
+
+private:
+    uint16_t getColorId(std::string_view color);
+    Cell* getCell(const Vec& position);
+    void put(const Cell& cell);
+
+    // If a block of lines moved up or down (i.e. the buffer scrolled), we move it on the terminal
+    // too using a scroll region, so we only have to draw the newly exposed lines.
+    struct LineShift {
+        // The lines [first, last] in back_ are the lines [first + offset, last + offset] in front_
+        size_t first;
+        size_t last;
+        int offset;
+    };
+    uint64_t hashLine(const std::vector<Cell>& cells, size_t y) const;
+    std::optional<LineShift> findLineShift() const;
+    void shiftLines(const LineShift& shift);
+
+    // These write to the terminal and keep track of its state
+    void moveTerminalCursor(const Vec& position);
+    void setTerminalStyle(const Cell& cell);
+    void writeCell(const Cell& cell);
+
+    Vec size_;
+    // What we draw into
+    std::vector<Cell> back_;
+    // What is currently on the terminal
+    std::vector<Cell> front_;
+    bool repaint_ = true;
+
+    Vec cursor_;
+    Cell style_; // glyph is ignored
+    // There are usually only a handful of colors, so a linear search is fast enough
+    std::vector<std::string> colors_;
+
+    Vec terminalCursor_;
+    bool terminalCursorValid_ = false; // we don't know where it is after a repaint
+    Cell terminalStyle_;
+};
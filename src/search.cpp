@@ -0,0 +1,257 @@
+#include "search.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EXQUISITE_SEARCH_X86
+#include <immintrin.h>
+#endif
+
+namespace search {
+namespace {
+    size_t findHorspool(
+        std::string_view haystack, std::string_view needle, const ShiftTable& shift)
+    {
+        const auto n = haystack.size();
+        const auto m = needle.size();
+        if (m > n)
+            return n;
+        const auto last = needle[m - 1];
+        size_t i = 0;
+        while (i + m <= n) {
+            const auto c = haystack[i + m - 1];
+            if (c == last && std::memcmp(haystack.data() + i, needle.data(), m - 1) == 0)
+                return i;
+            i += shift[static_cast<uint8_t>(c)];
+        }
+        return n;
+    }
+
+#ifdef EXQUISITE_SEARCH_X86
+    // Checks all the candidates in mask (bit i set => match at pos + i is possible)
+    size_t verify(std::string_view haystack, std::string_view needle, size_t pos, uint32_t mask)
+    {
+        // The first and the last byte have been compared already
+        const auto m = needle.size();
+        while (mask) {
+            const auto i = pos + static_cast<size_t>(__builtin_ctz(mask));
+            if (m <= 2 || std::memcmp(haystack.data() + i + 1, needle.data() + 1, m - 2) == 0)
+                return i;
+            mask &= mask - 1; // clear lowest set bit
+        }
+        return haystack.size();
+    }
+
+    // http://0x80.pl/articles/simd-strfind.html#generic-sse-avx2
+    // Looking at the last byte too, makes this a lot faster than just looking for the first byte
+    // (i.e. memchr), because in text the first byte is often very common (e.g. spaces).
+    size_t findSse2(std::string_view haystack, std::string_view needle, const ShiftTable& shift)
+    {
+        const auto n = haystack.size();
+        const auto m = needle.size();
+        if (m > n)
+            return n;
+        if (m == 1) {
+            const auto p = std::memchr(haystack.data(), needle[0], n);
+            return p ? static_cast<const char*>(p) - haystack.data() : n;
+        }
+
+        const auto first = _mm_set1_epi8(needle[0]);
+        const auto last = _mm_set1_epi8(needle[m - 1]);
+        size_t i = 0;
+        for (; i + m - 1 + 16 <= n; i += 16) {
+            const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack.data() + i));
+            const auto b
+                = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack.data() + i + m - 1));
+            const auto eq = _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last));
+            const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(eq));
+            if (mask) {
+                const auto idx = verify(haystack, needle, i, mask);
+                if (idx < n)
+                    return idx;
+            }
+        }
+        return i + findHorspool(haystack.substr(i), needle, shift);
+    }
+
+    __attribute__((target("avx2"))) size_t findAvx2(
+        std::string_view haystack, std::string_view needle, const ShiftTable& shift)
+    {
+        const auto n = haystack.size();
+        const auto m = needle.size();
+        if (m > n)
+            return n;
+        if (m == 1)
+            return findSse2(haystack, needle, shift);
+
+        const auto first = _mm256_set1_epi8(needle[0]);
+        const auto last = _mm256_set1_epi8(needle[m - 1]);
+        size_t i = 0;
+        for (; i + m - 1 + 32 <= n; i += 32) {
+            const auto a
+                = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack.data() + i));
+            const auto b = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(haystack.data() + i + m - 1));
+            const auto eq
+                = _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last));
+            const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+            if (mask) {
+                const auto idx = verify(haystack, needle, i, mask);
+                if (idx < n)
+                    return idx;
+            }
+        }
+        return i + findSse2(haystack.substr(i), needle, shift);
+    }
+#endif
+}
+
+const std::vector<Kernel>& getKernels()
+{
+    static const std::vector<Kernel> kernels = [] {
+        std::vector<Kernel> kernels { Kernel { "horspool", findHorspool } };
+#ifdef EXQUISITE_SEARCH_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2"))
+            kernels.push_back(Kernel { "sse2", findSse2 });
+        if (__builtin_cpu_supports("avx2"))
+            kernels.push_back(Kernel { "avx2", findAvx2 });
+#endif
+        return kernels;
+    }();
+    return kernels;
+}
+
+const Kernel& getKernel()
+{
+    static const Kernel& kernel = getKernels().back();
+    return kernel;
+}
+
+bool matchesAt(const TextBuffer& text, size_t offset, std::string_view str)
+{
+    if (offset + str.size() > text.getSize())
+        return false;
+    return text.forEachChunk(offset, offset + str.size(), [&str](std::string_view chunk) {
+        if (str.compare(0, chunk.size(), chunk) != 0)
+            return false;
+        str.remove_prefix(chunk.size());
+        return true;
+    });
+}
+
+ShiftTable makeShiftTable(std::string_view needle)
+{
+    ShiftTable shift;
+    // The last byte of the needle is not included, because we would not move at all
+    const auto m = needle.size();
+    shift.fill(std::max(m, size_t(1)));
+    for (size_t i = 0; i + 1 < m; ++i)
+        shift[static_cast<uint8_t>(needle[i])] = m - 1 - i;
+    return shift;
+}
+
+Pattern::Pattern(std::string_view needle)
+    : needle_(needle)
+    , shift_(makeShiftTable(needle))
+    , kernel_(getKernel())
+{
+}
+
+const std::string& Pattern::getNeedle() const
+{
+    return needle_;
+}
+
+size_t Pattern::find(std::string_view haystack) const
+{
+    if (needle_.empty())
+        return std::string_view::npos;
+    const auto idx = kernel_.find(haystack, needle_, shift_);
+    return idx < haystack.size() ? idx : std::string_view::npos;
+}
+
+size_t Pattern::find(const TextBuffer& text, size_t offset, size_t end) const
+{
+    size_t match = std::string_view::npos;
+    forEachMatch(text, offset, end, false, [&match](size_t offset) {
+        match = offset;
+        return false;
+    });
+    return match;
+}
+
+std::vector<size_t> Pattern::findAll(
+    const TextBuffer& text, size_t offset, size_t end, bool overlapping) const
+{
+    std::vector<size_t> matches;
+    forEachMatch(text, offset, end, overlapping, [&matches](size_t offset) {
+        matches.push_back(offset);
+        return true;
+    });
+    return matches;
+}
+
+template <typename Func>
+void Pattern::forEachMatch(
+    const TextBuffer& text, size_t offset, size_t end, bool overlapping, Func&& func) const
+{
+    const auto m = needle_.size();
+    if (m == 0)
+        return;
+    const auto step = overlapping ? 1 : m;
+
+    // The end of the last chunk, that a match might start in (at most m - 1 bytes). This is the
+    // only part of the text we copy.
+    std::string carry;
+    size_t carryStart = offset;
+    size_t chunkStart = offset;
+    text.forEachChunk(offset, end, [&](std::string_view chunk) {
+        auto hay = chunk;
+        auto hayStart = chunkStart;
+        size_t skip = 0; // where the next match may start
+        if (!carry.empty()) {
+            if (chunk.size() < m - 1) {
+                // Small chunks are rare, so we don't bother and just search all of it
+                carry.append(chunk);
+                hay = carry;
+                hayStart = carryStart;
+            } else {
+                // Every match starting in carry has to end in this chunk
+                const auto carrySize = carry.size();
+                carry.append(chunk.substr(0, m - 1));
+                size_t pos = 0;
+                while (pos < carrySize) {
+                    const auto idx = kernel_.find(
+                        std::string_view(carry).substr(pos), needle_, shift_);
+                    if (pos + idx >= carrySize)
+                        break;
+                    if (!func(carryStart + pos + idx))
+                        return false;
+                    pos += idx + step;
+                }
+                skip = pos > carrySize ? pos - carrySize : 0;
+            }
+        }
+
+        while (skip < hay.size()) {
+            const auto idx = kernel_.find(hay.substr(skip), needle_, shift_);
+            if (idx >= hay.size() - skip)
+                break;
+            if (!func(hayStart + skip + idx))
+                return false;
+            skip += idx + step;
+        }
+
+        const auto keep = std::max(skip, hay.size() - std::min(hay.size(), m - 1));
+        carryStart = hayStart + keep;
+        if (hay.data() == carry.data())
+            carry.erase(0, keep);
+        else
+            carry.assign(hay.substr(keep));
+        chunkStart += chunk.size();
+        return true;
+    });
+}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "textbuffer.hpp"
+
+// Substring search for find. The pattern is preprocessed once, so it's cheap to search many chunks
+// of a TextBuffer (or the same text many times).
+// Candidates are found by comparing the first and the last byte of the needle at 16/32 positions
+// at once and only those are compared completely. Without SIMD, Boyer-Moore-Horspool is used.
+namespace search {
+// How far we can skip ahead if the last byte of the window is a given byte
+using ShiftTable = std::array<size_t, 256>;
+ShiftTable makeShiftTable(std::string_view needle);
+
+struct Kernel {
+    std::string_view name;
+    // Returns the offset of the first occurence of needle in haystack or haystack.size().
+    // needle must not be empty.
+    size_t (*find)(std::string_view haystack, std::string_view needle, const ShiftTable& shift);
+};
+
+// Only the kernels that the CPU supports. The first one is the scalar fallback.
+const std::vector<Kernel>& getKernels();
+const Kernel& getKernel();
+
+// Returns whether str is at offset in text
+bool matchesAt(const TextBuffer& text, size_t offset, std::string_view str);
+
+class Pattern {
+public:
+    Pattern(std::string_view needle);
+
+    const std::string& getNeedle() const;
+
+    // Both return std::string_view::npos if there is no match
+    size_t find(std::string_view haystack) const;
+    // Returns the first match in [offset, end). This does not copy the text, except for matches
+    // that span the boundary between two chunks of the buffer.
+    size_t find(
+        const TextBuffer& text, size_t offset = 0, size_t end = std::string_view::npos) const;
+
+    // Returns the offsets of all matches in [offset, end). If overlapping is false, the search
+    // continues after the end of a match (like the find command counts matches).
+    std::vector<size_t> findAll(const TextBuffer& text, size_t offset = 0,
+        size_t end = std::string_view::npos, bool overlapping = false) const;
+
+private:
+    // func is called with the offset of every match and returns whether to go on
+    template <typename Func>
+    void forEachMatch(
+        const TextBuffer& text, size_t offset, size_t end, bool overlapping, Func&& func) const;
+
+    std::string needle_;
+    ShiftTable shift_;
+    const Kernel& kernel_;
+};
+}
@@ -81,6 +81,8 @@ inline std::vector<Shortcut>& getShortcuts()
         { Context::Buffer, Key(Modifiers::Ctrl, 'o'), commands::openFile(), "Open file" },
         { Context::Buffer, Key(Modifiers::Ctrl, 's'), commands::saveFile(), "Save file" },
         { Context::Buffer, Key(Modifiers::Ctrl, 'f'), commands::find(), "Find" },
+        { Context::Buffer, Key(Modifiers::Ctrl | Modifiers::Alt, 'f'), commands::findRegex(),
+            "Find regular expression" },
         { Context::Buffer, Key(Modifiers::Ctrl, 'n'), commands::findNextSelection(),
             "Find next occurence of current selection" },
         { Context::Buffer, Key(Modifiers::Ctrl | Modifiers::Alt, 'n'),
@@ -1,5 +1,6 @@
 #include "terminal.hpp"
 
+#include <array>
 #include <cassert>
 #include <cerrno>
 #include <cstdio>
@@ -7,6 +8,7 @@
 #include <cstring>
 
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
 
@@ -21,6 +23,66 @@ namespace {
 termios termiosBackup;
 std::vector<char> writeBuffer;
 
+// Input is read into this in big chunks and then decoded into keys from there
+class InputBuffer {
+public:
+    static constexpr size_t Capacity = 64 * 1024;
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    size_t getFreeSpace() const
+    {
+        return Capacity - size_;
+    }
+
+    char operator[](size_t index) const
+    {
+        assert(index < size_);
+        return data_[(start_ + index) % Capacity];
+    }
+
+    void consume(size_t num)
+    {
+        assert(num <= size_);
+        start_ = (start_ + num) % Capacity;
+        size_ -= num;
+    }
+
+    // Fills as much of the free space as possible with a single read
+    ssize_t read(int fd)
+    {
+        if (size_ == Capacity)
+            return 0;
+        const auto end = (start_ + size_) % Capacity;
+        iovec iov[2];
+        int iovCount = 1;
+        if (end < start_) {
+            iov[0] = iovec { &data_[end], start_ - end };
+        } else {
+            iov[0] = iovec { &data_[end], Capacity - end };
+            iov[1] = iovec { &data_[0], start_ };
+            iovCount = start_ > 0 ? 2 : 1;
+        }
+        const auto n = ::readv(fd, iov, iovCount);
+        if (n > 0)
+            size_ += n;
+        return n;
+    }
+
+private:
+    std::array<char, Capacity> data_;
+    size_t start_ = 0;
+    size_t size_ = 0;
+};
+
+InputBuffer input;
+bool inputComplete = true;
+// A paste might be bigger than the input buffer, so it is collected here until it ends
+std::optional<std::string> paste;
+
 void switchToAlternateScreen()
 {
     // https://stackoverflow.com/questions/52988525/restore-terminal-output-after-exit-program
@@ -35,6 +97,21 @@ void switchFromAlternateScreen()
     terminal::write("\x1b[?1049l");
 }
 
+// https://invisible-island.net/xterm/ctlseqs/ctlseqs.html#h2-Bracketed-Paste-Mode
+// Pasted text is wrapped in "\x1b[200~" and "\x1b[201~", so we can insert it all at once.
+constexpr auto pasteStart = "\x1b[200~"sv;
+constexpr auto pasteEnd = "\x1b[201~"sv;
+
+void enableBracketedPaste()
+{
+    terminal::write("\x1b[?2004h");
+}
+
+void disableBracketedPaste()
+{
+    terminal::write("\x1b[?2004l");
+}
+
 void setCursorStyle(int style)
 {
     terminal::write(control::setCursorStyle(style));
@@ -42,11 +119,174 @@ void setCursorStyle(int style)
 
 void deinit()
 {
+    disableBracketedPaste();
     switchFromAlternateScreen();
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &termiosBackup))
         die("tcsetattr");
     setCursorStyle(0);
 }
+
+std::optional<SpecialKey> getMovementKey(char ch)
+{
+    switch (ch) {
+    case 'A':
+        return SpecialKey::Up;
+    case 'B':
+        return SpecialKey::Down;
+    case 'C':
+        return SpecialKey::Right;
+    case 'D':
+        return SpecialKey::Left;
+    case 'H':
+        return SpecialKey::Home;
+    case 'F':
+        return SpecialKey::End;
+    default:
+        return std::nullopt;
+    }
+}
+
+std::optional<SpecialKey> getTildeKey(std::string_view num)
+{
+    if (num == "1" || num == "7")
+        return SpecialKey::Home;
+    if (num == "3")
+        return SpecialKey::Delete;
+    if (num == "4" || num == "8")
+        return SpecialKey::End;
+    if (num == "5")
+        return SpecialKey::PageUp;
+    if (num == "6")
+        return SpecialKey::PageDown;
+    return std::nullopt;
+}
+
+// xterm encodes modifiers as 1 + (Shift ? 1 : 0) + (Alt ? 2 : 0) + (Ctrl ? 4 : 0)
+std::optional<Bitmask<Modifiers>> getModifiers(std::string_view param)
+{
+    if (param.size() != 1 || param[0] < '2' || param[0] > '8')
+        return std::nullopt;
+    const auto mask = param[0] - '1';
+    Bitmask<Modifiers> modifiers;
+    if (mask & 1)
+        modifiers.set(Modifiers::Shift);
+    if (mask & 2)
+        modifiers.set(Modifiers::Alt);
+    if (mask & 4)
+        modifiers.set(Modifiers::Ctrl);
+    return modifiers;
+}
+
+// Interprets a complete CSI sequence. seq includes the "\x1b[".
+Key decodeCsi(const std::vector<char>& seq)
+{
+    const auto final = seq.back();
+    const auto params = std::string_view(seq.data() + 2, seq.size() - 3);
+    const auto semicolon = params.find(';');
+    const auto first = params.substr(0, semicolon);
+    const auto modifiers = semicolon != std::string_view::npos
+        ? getModifiers(params.substr(semicolon + 1))
+        : std::optional<Bitmask<Modifiers>>(Bitmask<Modifiers>());
+
+    if (modifiers) {
+        if (final == '~') {
+            if (const auto key = getTildeKey(first))
+                return Key(seq, *modifiers, *key);
+        } else if (final == 'Z' && params.empty()) { // weird, I know
+            return Key(seq, Modifiers::Shift, SpecialKey::Tab);
+        } else if (first.empty() || first == "1") {
+            if (const auto key = getMovementKey(final))
+                return Key(seq, *modifiers, *key);
+        }
+    }
+    return Key(seq, SpecialKey::Escape);
+}
+
+// Decodes a single key from the start of the input buffer and returns it and the number of bytes
+// it took up. If the input ends in the middle of a key, it returns std::nullopt. If complete is
+// true, we know there is nothing else coming though, so we take what we have instead (i.e. a single
+// "\x1b" is just the escape key), except for utf8 code points, which we can't do anything with.
+std::optional<std::pair<Key, size_t>> decodeKey(const InputBuffer& input, bool complete)
+{
+    assert(input.size() > 0);
+    const auto ch = input[0];
+    std::vector<char> seq { ch };
+
+    // probably utf8 code unit
+    if (ch < 0) {
+        const auto seqLength = utf8::getCodePointLength(ch);
+        if (input.size() < seqLength)
+            return std::nullopt;
+        for (size_t i = 1; i < seqLength; ++i)
+            seq.push_back(input[i]);
+        return std::pair(Key(seq), seqLength);
+    }
+
+    // TODO: Be smarter about Ctrl. Ctrl is pressed if the first two bits are 00
+
+    if (ch == 9)
+        return std::pair(Key(seq, SpecialKey::Tab), 1);
+
+    if (ch == 13)
+        return std::pair(Key(seq, SpecialKey::Return), 1);
+
+    if (ch == 127)
+        return std::pair(Key(seq, SpecialKey::Backspace), 1);
+
+    if (ch > 0 && ch < 27)
+        return std::pair(Key(seq, Modifiers::Ctrl, ch - 1 + 'a'), 1);
+
+    if (ch != 27)
+        return std::pair(Key(seq, ch), 1);
+
+    // From now on if we can't understand the sequence, just return Escape
+    if (input.size() < 2) {
+        if (!complete)
+            return std::nullopt;
+        return std::pair(Key(seq, SpecialKey::Escape), 1);
+    }
+    seq.push_back(input[1]);
+
+    if (seq[1] == '[') {
+        // https://en.wikipedia.org/wiki/ANSI_escape_code#CSI_(Control_Sequence_Introducer)_sequences
+        // Parameter bytes (0x30-0x3F), then intermediate bytes (0x20-0x2F), then a final byte
+        for (size_t i = 2; i < input.size(); ++i) {
+            const auto c = input[i];
+            seq.push_back(c);
+            if (c >= 0x40 && c <= 0x7E)
+                return std::pair(decodeCsi(seq), seq.size());
+            if (c < 0x20 || c > 0x3F) // invalid
+                return std::pair(Key(seq, SpecialKey::Escape), seq.size());
+        }
+        if (!complete)
+            return std::nullopt;
+        return std::pair(Key(seq, SpecialKey::Escape), seq.size());
+    } else if (seq[1] == 'O') {
+        if (input.size() < 3) {
+            if (!complete)
+                return std::nullopt;
+            return std::pair(Key(seq, Modifiers::Alt, 'O'), 2);
+        }
+        seq.push_back(input[2]);
+
+        switch (seq[2]) {
+        case 'H':
+            return std::pair(Key(seq, SpecialKey::Home), 3);
+        case 'F':
+            return std::pair(Key(seq, SpecialKey::End), 3);
+        default:
+            return std::pair(Key(seq, SpecialKey::Escape), 3);
+        }
+    } else if (seq[1] == 13) {
+        return std::pair(Key(seq, Modifiers::Alt, SpecialKey::Return), 2);
+    } else if (seq[1] > 0 && seq[1] < 27) {
+        return std::pair(Key(seq, Modifiers::Ctrl | Modifiers::Alt, seq[1] - 1 + 'a'), 2);
+    } else if (seq[1] == 127) {
+        return std::pair(Key(seq, Modifiers::Alt, SpecialKey::Backspace), 2);
+    } else {
+        return std::pair(Key(seq, Modifiers::Alt, seq[1]), 2);
+    }
+}
 }
 
 namespace terminal {
@@ -54,6 +294,7 @@ void init()
 {
     atexit(deinit);
     switchToAlternateScreen();
+    enableBracketedPaste();
     setCursorStyle(Config::get().cursor);
     if (tcgetattr(STDIN_FILENO, &termiosBackup)) {
         die("tcgetattr");
@@ -125,164 +366,63 @@ Vec getCursorPosition()
     return Vec { static_cast<size_t>(x - 1), static_cast<size_t>(y - 1) };
 }
 
-void readAll(std::vector<char>& seq)
+size_t readInput()
 {
-    char ch;
-    while (read(STDIN_FILENO, &ch, 1) == 1)
-        seq.push_back(ch);
-}
-
-std::optional<SpecialKey> getMovementKey(char ch)
-{
-    switch (ch) {
-    case 'A':
-        return SpecialKey::Up;
-    case 'B':
-        return SpecialKey::Down;
-    case 'C':
-        return SpecialKey::Right;
-    case 'D':
-        return SpecialKey::Left;
-    case 'H':
-        return SpecialKey::Home;
-    case 'F':
-        return SpecialKey::End;
-    default:
-        return std::nullopt;
-    }
+    const auto free = input.getFreeSpace();
+    const auto nread = input.read(STDIN_FILENO);
+    if (nread == -1 && errno != EAGAIN)
+        die("read");
+    // If we filled the buffer completely, there is probably more and a key might be cut off
+    inputComplete = nread < static_cast<ssize_t>(free);
+    return nread > 0 ? nread : 0;
 }
 
 std::optional<Key> readKey()
 {
-    char ch = 0;
-    // Loop until we get an error or a character
-    const int nread = ::read(STDIN_FILENO, &ch, 1);
-    if (nread == -1 && errno != EAGAIN)
-        die("read");
-    if (nread == 0)
-        return std::nullopt;
-
-    std::vector<char> seq { ch };
-    seq.reserve(32);
-
-    // probably utf8 code unit
-    if (ch < 0) {
-        const auto seqLength = utf8::getCodePointLength(ch);
-        seq.resize(seqLength, '\0');
-        if (read(STDIN_FILENO, &seq[1], seqLength - 1) != static_cast<int>(seqLength) - 1)
-            return std::nullopt;
-        return Key(seq);
-    }
-
-    // TODO: Be smarter about Ctrl. Ctrl is pressed if the first two bits are 00
-
-    if (seq[0] == 9)
-        return Key(seq, SpecialKey::Tab);
-
-    if (seq[0] == 13)
-        return Key(seq, SpecialKey::Return);
-
-    if (seq[0] == 27) {
-        // From now on if we can't understand the sequence, just return Escape
-
-        if (read(STDIN_FILENO, &ch, 1) != 1)
-            return Key(seq, SpecialKey::Escape);
-        seq.push_back(ch);
-
-        if (seq[1] == '[') {
-            if (read(STDIN_FILENO, &ch, 1) != 1)
-                return Key(seq, SpecialKey::Escape);
-            seq.push_back(ch);
-
-            if (seq[2] >= '0' && seq[2] <= '9') {
-                if (read(STDIN_FILENO, &ch, 1) != 1)
-                    return Key(seq, SpecialKey::Escape);
-                seq.push_back(ch);
-
-                if (seq[3] == '~') {
-                    switch (seq[2]) {
-                    case '1':
-                        return Key(seq, SpecialKey::Home);
-                    case '3':
-                        return Key(seq, SpecialKey::Delete);
-                    case '4':
-                        return Key(seq, SpecialKey::End);
-                    case '5':
-                        return Key(seq, SpecialKey::PageUp);
-                    case '6':
-                        return Key(seq, SpecialKey::PageDown);
-                    case '7':
-                        return Key(seq, SpecialKey::Home);
-                    case '8':
-                        return Key(seq, SpecialKey::End);
-                    default:
-                        break;
-                    }
-                } else if (seq[2] == '1' && seq[3] == ';') {
-                    for (size_t i = 0; i < 2; ++i) {
-                        if (read(STDIN_FILENO, &ch, 1) != 1)
-                            return Key(seq, SpecialKey::Escape);
-                        seq.push_back(ch);
-                    }
-
-                    if (seq[4] >= '2' && seq[4] <= '6') {
-                        decltype(Key::modifiers) modifiers;
-                        if (seq[4] == '5' || seq[4] == '6')
-                            modifiers.set(Modifiers::Ctrl);
-                        if (seq[4] == '3' || seq[4] == '4')
-                            modifiers.set(Modifiers::Alt);
-                        if (seq[4] == '2' || seq[4] == '4' || seq[4] == '6')
-                            modifiers.set(Modifiers::Shift);
-
-                        const auto movementKey = getMovementKey(seq[5]);
-                        if (movementKey)
-                            return Key(seq, modifiers, *movementKey);
+    if (paste) {
+        while (input.size() > 0) {
+            paste->push_back(input[0]);
+            input.consume(1);
+            auto& str = *paste;
+            if (str.back() == '~' && str.size() >= pasteEnd.size()
+                && str.compare(str.size() - pasteEnd.size(), pasteEnd.size(), pasteEnd) == 0) {
+                str.resize(str.size() - pasteEnd.size());
+                // Terminals send newlines as carriage returns
+                std::vector<char> bytes;
+                bytes.reserve(str.size());
+                for (size_t i = 0; i < str.size(); ++i) {
+                    if (str[i] == '\r') {
+                        bytes.push_back('\n');
+                        if (i + 1 < str.size() && str[i + 1] == '\n')
+                            i++;
+                    } else {
+                        bytes.push_back(str[i]);
                     }
                 }
-            } else if (seq[2] == 'Z') { // weird, I know
-                return Key(seq, Modifiers::Shift, SpecialKey::Tab);
-            } else {
-                const auto movementKey = getMovementKey(seq[2]);
-                if (movementKey)
-                    return Key(seq, *movementKey);
-            }
-
-            readAll(seq);
-            return Key(seq, SpecialKey::Escape);
-        } else if (seq[1] == 'O') {
-            if (read(STDIN_FILENO, &ch, 1) != 1)
-                return Key(seq, Modifiers::Alt, 'O');
-            seq.push_back(ch);
-
-            switch (seq[2]) {
-            case 'H':
-                return Key(seq, SpecialKey::Home);
-            case 'F':
-                return Key(seq, SpecialKey::End);
-            default:
-                break;
+                paste.reset();
+                return Key(bytes, SpecialKey::Paste);
             }
-
-            readAll(seq);
-            return Key(seq, SpecialKey::Escape);
-        } else if (seq[1] == 13) {
-            return Key(seq, Modifiers::Alt, SpecialKey::Return);
-        } else if (seq[1] > 0 && seq[1] < 27) {
-            return Key(seq, Modifiers::Ctrl | Modifiers::Alt, seq[1] - 1 + 'a');
-        } else if (seq[1] == 127) {
-            return Key(seq, Modifiers::Alt, SpecialKey::Backspace);
-        } else {
-            return Key(seq, Modifiers::Alt, seq[1]);
         }
+        return std::nullopt;
     }
 
-    if (seq[0] == 127)
-        return Key(seq, SpecialKey::Backspace);
-
-    if (seq[0] > 0 && seq[0] < 27)
-        return Key(seq, Modifiers::Ctrl, seq[0] - 1 + 'a');
+    if (input.size() == 0)
+        return std::nullopt;
+    const auto key = decodeKey(input, inputComplete);
+    if (!key) {
+        // If nothing is coming anymore, this is a broken utf8 code point. Just throw it away.
+        if (inputComplete)
+            input.consume(input.size());
+        return std::nullopt;
+    }
+    input.consume(key->second);
 
-    return Key(seq, seq[0]);
+    const auto& bytes = key->first.bytes;
+    if (std::string_view(bytes.data(), bytes.size()) == pasteStart) {
+        paste = std::string();
+        return readKey();
+    }
+    return key->first;
 }
 
 void write(std::string_view str)
@@ -13,6 +13,11 @@ Vec getSize();
 Vec getCursorPosition();
 
 // input
+// Reads everything that is available on stdin (as far as it fits) with a single read.
+// Returns the number of bytes read.
+size_t readInput();
+// Decodes the next key from what readInput read. Does not read from stdin itself, so call it until
+// it returns std::nullopt after each readInput.
 std::optional<Key> readKey();
 
 // output
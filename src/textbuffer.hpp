@@ -2,11 +2,10 @@
 
 #include <string>
 #include <string_view>
-#include <vector>
 
+#include "rope.hpp"
 #include "util.hpp"
 
-// TODO: Use a Rope: https://en.wikipedia.org/wiki/Rope_(data_structure)
 class TextBuffer {
 public:
     using LineIndex = size_t;
@@ -21,6 +20,11 @@ public:
     std::string getString() const;
     // This gives you as much string as you can have from a given offset
     std::string_view getString(size_t offset) const;
+    // See Rope::forEachChunk
+    bool forEachChunk(
+        size_t offset, size_t end, const std::function<bool(std::string_view)>& func) const;
+    bool forEachChunkBackwards(
+        size_t offset, size_t end, const std::function<bool(std::string_view)>& func) const;
 
     size_t getLineCount() const;
     Range getLine(LineIndex idx) const;
@@ -31,9 +35,6 @@ public:
     void remove(const Range& range);
 
 private:
-    void updateLineOffsets();
-    bool checkLineOffsets() const;
-
-    std::vector<char> data_;
-    std::vector<size_t> lineOffsets_;
+    // The rope also keeps track of the newlines in each subtree, so it doubles as our line index
+    Rope data_;
 };
@@ -0,0 +1,54 @@
+#include "threadpool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t numThreads)
+{
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    threads_.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; ++i)
+        threads_.emplace_back([this] { workerMain(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(mutex_);
+        quit_ = true;
+        tasks_.clear();
+    }
+    condition_.notify_all();
+    for (auto& thread : threads_)
+        thread.join();
+}
+
+size_t ThreadPool::getThreadCount() const
+{
+    return threads_.size();
+}
+
+void ThreadPool::push(std::function<void()> task)
+{
+    {
+        std::lock_guard lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    condition_.notify_one();
+}
+
+void ThreadPool::workerMain()
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(mutex_);
+            condition_.wait(lock, [this] { return quit_ || !tasks_.empty(); });
+            if (quit_)
+                return;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed number of worker threads that run tasks in the order they were pushed.
+// You probably want EventHandler::addJob, which gets you a callback on the main thread when the
+// task is done.
+class ThreadPool {
+public:
+    // 0 means one thread per core
+    ThreadPool(size_t numThreads = 0);
+    // Waits for the tasks that are running right now. Tasks that have not started are dropped.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t getThreadCount() const;
+
+    void push(std::function<void()> task);
+
+private:
+    void workerMain();
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<std::function<void()>> tasks_;
+    bool quit_ = false;
+    std::vector<std::thread> threads_; // last, so everything is initialized when they start
+};
@@ -210,8 +210,12 @@ std::unique_ptr<Tree> Parser::parse(
     const Tree* oldTree, std::function<ReadCallback> callback, InputEncoding encoding)
 {
     readCallback_ = callback;
-    return std::make_unique<Tree>(ts_parser_parse(parser_, oldTree ? oldTree->get() : nullptr,
-        TSInput { this, readCallback, static_cast<TSInputEncoding>(encoding) }));
+    const auto tree = ts_parser_parse(parser_, oldTree ? oldTree->get() : nullptr,
+        TSInput { this, readCallback, static_cast<TSInputEncoding>(encoding) });
+    // This happens if parsing was cancelled or timed out
+    if (!tree)
+        return nullptr;
+    return std::make_unique<Tree>(tree);
 }
 
 std::unique_ptr<Tree> Parser::parseString(const Tree* oldTree, std::string_view string)
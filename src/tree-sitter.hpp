@@ -131,6 +131,7 @@ public:
 
     using ReadCallback = std::pair<const char*, size_t>(size_t byteIndex, TSPoint position);
 
+    // Returns nullptr if parsing was cancelled or timed out
     std::unique_ptr<Tree> parse(
         const Tree* oldTree, std::function<ReadCallback> callback, InputEncoding encoding);
 
@@ -4,15 +4,14 @@
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
-#include <queue>
 #include <charconv>
 
-#include <dirent.h>
 #include <fcntl.h>
 #include <ftw.h>
 #include <unistd.h>
 
 #include "debug.hpp"
+#include "newline.hpp"
 
 Indentation::Indentation()
     : Indentation(Config::get().indentUsingSpaces, Config::get().indentWidth)
@@ -134,7 +133,7 @@ std::string readAll(int fd)
 
 size_t countNewlines(std::string_view str)
 {
-    return std::count(str.begin(), str.end(), '\n');
+    return newline::count(str);
 }
 
 bool hasNewlines(std::string_view str)
@@ -179,11 +178,8 @@ Indentation detectLineIndent(std::string_view line)
 
 size_t getNextLineOffset(std::string_view text, size_t offset)
 {
-    for (size_t i = offset; i < text.size(); ++i) {
-        if (text[i] == '\n')
-            return i + 1;
-    }
-    return text.size();
+    const auto idx = text.find('\n', offset);
+    return idx != std::string_view::npos ? idx + 1 : text.size();
 }
 
 Indentation detectIndentation(std::string_view text)
@@ -266,47 +262,3 @@ std::string trimTrailingWhitespace(std::string_view str)
     }
     return out;
 }
-
-std::optional<std::vector<std::string>> walkDirectory(
-    const fs::path& dirPath, size_t maxDepth, size_t maxItems)
-{
-    struct Dir {
-        std::string path;
-        size_t depth;
-    };
-
-    std::queue<Dir> dirs;
-    dirs.push(Dir { dirPath.u8string(), 0 });
-
-    std::vector<std::string> files;
-    while (!dirs.empty()) {
-        auto cur = dirs.front();
-        dirs.pop();
-
-        DIR* dir = ::opendir(cur.path.c_str());
-        if (!dir) {
-            return std::nullopt;
-        }
-
-        dirent* ent;
-        while ((ent = ::readdir(dir))) {
-            // Skip ".", ".." and everything hidden
-            const std::string name = ent->d_name;
-            std::string path = cur.path;
-            path.reserve(path.size() + 1 + name.size());
-            path.push_back('/');
-            path.append(name);
-
-            if (ent->d_type == DT_DIR && cur.depth < maxDepth && ent->d_name[0] != '.') {
-                dirs.push(Dir { path, cur.depth + 1 });
-            } else if (ent->d_type == DT_REG) {
-                files.push_back(std::move(path));
-                if (files.size() >= maxItems) {
-                    break;
-                }
-            }
-        }
-        ::closedir(dir);
-    }
-    return files;
-}